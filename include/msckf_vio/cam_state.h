@@ -8,11 +8,15 @@
 #ifndef MSCKF_VIO_CAM_STATE_H
 #define MSCKF_VIO_CAM_STATE_H
 
-#include <map>
 #include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
 #include <Eigen/Dense>
 
 #include "imu_state.h"
+#include "math_utils.hpp"
 
 namespace msckf_vio {
 /*
@@ -50,18 +54,420 @@ struct CAMState {
     orientation(Eigen::Vector4d(0, 0, 0, 1)),
     position(Eigen::Vector3d::Zero()),
     orientation_null(Eigen::Vector4d(0, 0, 0, 1)),
-    position_null(Eigen::Vector3d(0, 0, 0)) {}
+    position_null(Eigen::Vector3d(0, 0, 0)),
+    is_pose_cached(false),
+    cached_R_w_c0(Eigen::Matrix3d::Zero()),
+    cached_R_w_c1(Eigen::Matrix3d::Zero()),
+    cached_t_c1_w(Eigen::Vector3d::Zero()),
+    cached_T_c0_w(Eigen::Isometry3d::Identity()) {}
 
   CAMState(const StateIDType& new_id ): id(new_id), time(0),
     orientation(Eigen::Vector4d(0, 0, 0, 1)),
     position(Eigen::Vector3d::Zero()),
     orientation_null(Eigen::Vector4d(0, 0, 0, 1)),
-    position_null(Eigen::Vector3d::Zero()) {}
+    position_null(Eigen::Vector3d::Zero()),
+    is_pose_cached(false),
+    cached_R_w_c0(Eigen::Matrix3d::Zero()),
+    cached_R_w_c1(Eigen::Matrix3d::Zero()),
+    cached_t_c1_w(Eigen::Vector3d::Zero()),
+    cached_T_c0_w(Eigen::Isometry3d::Identity()) {}
+
+  // Poses of the stereo cameras derived from `orientation` and
+  // `position`. They are computed when first used, and cached
+  // until updatePoseCache() or invalidatePoseCache() is called,
+  // which should be done after changing the state.
+  // Rotation from the world frame to the cam0 frame.
+  const Eigen::Matrix3d& R_w_c0() const {
+    if (!is_pose_cached) updatePoseCache();
+    return cached_R_w_c0;
+  }
+  // Rotation from the world frame to the cam1 frame.
+  const Eigen::Matrix3d& R_w_c1() const {
+    if (!is_pose_cached) updatePoseCache();
+    return cached_R_w_c1;
+  }
+  // Position of the cam1 frame in the world frame.
+  const Eigen::Vector3d& t_c1_w() const {
+    if (!is_pose_cached) updatePoseCache();
+    return cached_t_c1_w;
+  }
+  // Takes a vector from the cam0 frame to the world frame.
+  const Eigen::Isometry3d& T_c0_w() const {
+    if (!is_pose_cached) updatePoseCache();
+    return cached_T_c0_w;
+  }
+
+  /*
+   * @brief updatePoseCache Compute the cached poses from the
+   *    current state.
+   * @note The cache is shared by all the threads reading the
+   *    state, so it should be updated before the state is read
+   *    in parallel.
+   */
+  void updatePoseCache() const {
+    cached_R_w_c0 = quaternionToRotation(orientation);
+    cached_R_w_c1 = T_cam0_cam1.linear() * cached_R_w_c0;
+    cached_t_c1_w = position -
+      cached_R_w_c1.transpose()*T_cam0_cam1.translation();
+
+    cached_T_c0_w.linear() = Eigen::Quaterniond(orientation(3),
+        orientation(0), orientation(1), orientation(2)).toRotationMatrix();
+    cached_T_c0_w.translation() = position;
+    cached_T_c0_w.makeAffine();
+    is_pose_cached = true;
+    return;
+  }
+
+  void invalidatePoseCache() {
+    is_pose_cached = false;
+    return;
+  }
+
+ private:
+  mutable bool is_pose_cached;
+  mutable Eigen::Matrix3d cached_R_w_c0;
+  mutable Eigen::Matrix3d cached_R_w_c1;
+  mutable Eigen::Vector3d cached_t_c1_w;
+  mutable Eigen::Isometry3d cached_T_c0_w;
 };
 
-typedef std::map<StateIDType, CAMState, std::less<int>,
-        Eigen::aligned_allocator<
-        std::pair<const StateIDType, CAMState> > > CamStateServer;
+/*
+ * @brief CamStateServer Camera states ordered by their ids, each
+ *    taking one of a fixed number of slots.
+ * @note The interface follows the std::map it replaces. The id of
+ *    an element should not be changed through an iterator. The
+ *    slot of a camera state does not change while it is stored,
+ *    and the filter keeps the covariance of the state in the
+ *    block of the same slot. Looking up the slot of an id takes
+ *    constant time. The ids are expected to be added in increasing
+ *    order, which makes adding a state and removing the oldest one
+ *    constant time as well.
+ */
+class CamStateServer {
+ public:
+  typedef StateIDType key_type;
+  typedef CAMState mapped_type;
+  typedef std::pair<StateIDType, CAMState> value_type;
+
+ private:
+  template <bool IsConst>
+  class IteratorBase {
+   public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef CamStateServer::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename std::conditional<IsConst,
+            const value_type*, value_type*>::type pointer;
+    typedef typename std::conditional<IsConst,
+            const value_type&, value_type&>::type reference;
+    typedef typename std::conditional<IsConst,
+            const CamStateServer*, CamStateServer*>::type ServerPtr;
+
+    IteratorBase(): server(nullptr), pos(0) {}
+    IteratorBase(ServerPtr s, const int& p): server(s), pos(p) {}
+    // Conversion from iterator to const_iterator.
+    IteratorBase(const IteratorBase<false>& other):
+      server(other.server), pos(other.pos) {}
+
+    // Slot of the camera state pointed to.
+    int slot() const {
+      return server->orderedSlot(pos);
+    }
+
+    reference operator*() const {
+      return server->values[slot()];
+    }
+    pointer operator->() const {
+      return &server->values[slot()];
+    }
+
+    IteratorBase& operator++() {
+      ++pos;
+      return *this;
+    }
+    IteratorBase operator++(int) {
+      IteratorBase tmp(*this);
+      ++pos;
+      return tmp;
+    }
+    IteratorBase& operator--() {
+      --pos;
+      return *this;
+    }
+    IteratorBase operator--(int) {
+      IteratorBase tmp(*this);
+      --pos;
+      return tmp;
+    }
+
+    bool operator==(const IteratorBase& other) const {
+      return pos == other.pos;
+    }
+    bool operator!=(const IteratorBase& other) const {
+      return pos != other.pos;
+    }
+
+   private:
+    friend class CamStateServer;
+    friend class IteratorBase<!IsConst>;
+
+    ServerPtr server;
+    // Position in the order of the ids.
+    int pos;
+  };
+
+ public:
+  typedef IteratorBase<false> iterator;
+  typedef IteratorBase<true> const_iterator;
+
+  /*
+   * @brief CamStateServer
+   * @param slot_num: Number of slots. More slots are added if
+   *    a state is added while all of them are taken, which
+   *    invalidates the references to the stored states.
+   */
+  CamStateServer(const int& slot_num = 0) {
+    reset(slot_num);
+  }
+
+  int slotNum() const {
+    return values.size();
+  }
+
+  size_t size() const {
+    return state_num;
+  }
+
+  bool empty() const {
+    return state_num == 0;
+  }
+
+  iterator begin() {
+    return iterator(this, 0);
+  }
+  iterator end() {
+    return iterator(this, state_num);
+  }
+  const_iterator begin() const {
+    return const_iterator(this, 0);
+  }
+  const_iterator end() const {
+    return const_iterator(this, state_num);
+  }
+
+  /*
+   * @brief slot Slot of a camera state, or -1 if the id is not
+   *    stored.
+   */
+  int slot(const StateIDType& id) const {
+    if (id_table.empty()) return -1;
+    const int entry = tableEntry(id);
+    return entry >= 0 ? id_table[entry] : -1;
+  }
+
+  iterator find(const StateIDType& id) {
+    const int s = slot(id);
+    return s < 0 ? end() : iterator(this, orderedPos(s));
+  }
+  const_iterator find(const StateIDType& id) const {
+    const int s = slot(id);
+    return s < 0 ? end() : const_iterator(this, orderedPos(s));
+  }
+
+  size_t count(const StateIDType& id) const {
+    return slot(id) >= 0 ? 1 : 0;
+  }
+
+  /*
+   * @brief at Camera state of an id, which should be stored.
+   */
+  CAMState& at(const StateIDType& id) {
+    return values[slot(id)].second;
+  }
+  const CAMState& at(const StateIDType& id) const {
+    return values[slot(id)].second;
+  }
+
+  CAMState& operator[](const StateIDType& id) {
+    const int s = slot(id);
+    if (s >= 0) return values[s].second;
+    return values[insert(id)].second;
+  }
+
+  /*
+   * @brief erase Remove a camera state, and free its slot.
+   * @return The number of removed states.
+   */
+  size_t erase(const StateIDType& id) {
+    const int s = slot(id);
+    if (s < 0) return 0;
+
+    // Close the gap in the order from the closer end.
+    const int pos = orderedPos(s);
+    if (pos < state_num/2) {
+      for (int i = pos; i > 0; --i) moveInRing(i-1, i);
+      head = ringIndex(1);
+    } else {
+      for (int i = pos; i < state_num-1; ++i) moveInRing(i+1, i);
+    }
+    --state_num;
+
+    eraseTableEntry(tableEntry(id));
+    values[s].second = CAMState();
+    free_slots.push_back(s);
+    return 1;
+  }
+
+  /*
+   * @brief clear Remove all the camera states. The slots are
+   *    taken again from the first one.
+   */
+  void clear() {
+    reset(values.size());
+    return;
+  }
+
+ private:
+  void reset(const int& slot_num) {
+    values.assign(slot_num, value_type());
+    ring.assign(slot_num, -1);
+    ring_index.assign(slot_num, -1);
+    head = 0;
+    state_num = 0;
+    free_slots.clear();
+    for (int i = slot_num-1; i >= 0; --i)
+      free_slots.push_back(i);
+    id_table.assign(tableSize(2*slot_num), -1);
+    return;
+  }
+
+  static int tableSize(const int& min_size) {
+    int size = 8;
+    while (size < min_size) size *= 2;
+    return size;
+  }
+
+  int ringIndex(const int& pos) const {
+    return (head+pos) % ring.size();
+  }
+
+  int orderedSlot(const int& pos) const {
+    return ring[ringIndex(pos)];
+  }
+
+  // Position of a taken slot in the order of the ids.
+  int orderedPos(const int& slot) const {
+    return (ring_index[slot]-head+ring.size()) % ring.size();
+  }
+
+  // Move the slot at a position in the order to another one.
+  void moveInRing(const int& from, const int& to) {
+    const int s = orderedSlot(from);
+    ring[ringIndex(to)] = s;
+    ring_index[s] = ringIndex(to);
+    return;
+  }
+
+  // Add a new id, and return its slot.
+  int insert(const StateIDType& id) {
+    if (free_slots.empty()) addSlots();
+
+    const int s = free_slots.back();
+    free_slots.pop_back();
+    values[s].first = id;
+    values[s].second = CAMState(id);
+    insertTableEntry(s);
+
+    // The new id is placed after the larger ones are shifted.
+    int pos = state_num;
+    while (pos > 0 && values[orderedSlot(pos-1)].first > id) {
+      moveInRing(pos-1, pos);
+      --pos;
+    }
+    ring[ringIndex(pos)] = s;
+    ring_index[s] = ringIndex(pos);
+    ++state_num;
+    return s;
+  }
+
+  void addSlots() {
+    const int old_num = values.size();
+    const int new_num = old_num > 0 ? 2*old_num : 8;
+
+    std::vector<int> new_ring(new_num, -1);
+    ring_index.assign(new_num, -1);
+    for (int i = 0; i < state_num; ++i) {
+      new_ring[i] = orderedSlot(i);
+      ring_index[new_ring[i]] = i;
+    }
+    ring.swap(new_ring);
+    head = 0;
+
+    values.resize(new_num);
+    for (int i = new_num-1; i >= old_num; --i)
+      free_slots.push_back(i);
+    id_table.assign(tableSize(2*new_num), -1);
+    for (int i = 0; i < state_num; ++i)
+      insertTableEntry(orderedSlot(i));
+    return;
+  }
+
+  int homeEntry(const StateIDType& id) const {
+    return id & (id_table.size()-1);
+  }
+
+  // Entry of an id in the table, or -1 if it is not stored.
+  int tableEntry(const StateIDType& id) const {
+    const int mask = id_table.size() - 1;
+    for (int e = homeEntry(id); id_table[e] >= 0; e = (e+1) & mask)
+      if (values[id_table[e]].first == id) return e;
+    return -1;
+  }
+
+  void insertTableEntry(const int& slot) {
+    const int mask = id_table.size() - 1;
+    int e = homeEntry(values[slot].first);
+    while (id_table[e] >= 0) e = (e+1) & mask;
+    id_table[e] = slot;
+    return;
+  }
+
+  // Empty an entry, and move the following entries of the
+  // probe sequence back, so that no lookup stops early.
+  void eraseTableEntry(int e) {
+    const int mask = id_table.size() - 1;
+    for (int next = (e+1) & mask; id_table[next] >= 0;
+        next = (next+1) & mask) {
+      // An entry can move back to e only if its home entry is
+      // not cyclically in (e, next].
+      const int home = homeEntry(values[id_table[next]].first);
+      if (((next-home) & mask) < ((next-e) & mask)) continue;
+      id_table[e] = id_table[next];
+      e = next;
+    }
+    id_table[e] = -1;
+    return;
+  }
+
+  // Camera states indexed by their slots.
+  std::vector<value_type, Eigen::aligned_allocator<value_type> > values;
+
+  // Slots of the stored states in the order of their ids, as
+  // a ring buffer of state_num entries from head.
+  std::vector<int> ring;
+  int head;
+  int state_num;
+  // Index in the ring of each taken slot.
+  std::vector<int> ring_index;
+
+  // Slots not taken, the next one to be taken last.
+  std::vector<int> free_slots;
+
+  // Slots of the stored ids, hashed by the id modulo the size
+  // with linear probing. The size is a power of two, at least
+  // twice the number of slots, and only changes with it.
+  std::vector<int> id_table;
+};
 } // namespace msckf_vio
 
 #endif // MSCKF_VIO_CAM_STATE_H
@@ -11,6 +11,9 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <utility>
+#include <iterator>
+#include <type_traits>
 
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
@@ -19,6 +22,9 @@
 #include "math_utils.hpp"
 #include "imu_state.h"
 #include "cam_state.h"
+#include "observation_map.hpp"
+#include "thread_pool.hpp"
+#include "triangulation_kernel.hpp"
 
 namespace msckf_vio {
 
@@ -140,9 +146,7 @@ struct Feature {
 
   // Store the observations of the features in the
   // state_id(key)-image_coordinates(value) manner.
-  std::map<StateIDType, Eigen::Vector2d, std::less<StateIDType>,
-    Eigen::aligned_allocator<
-      std::pair<const StateIDType, Eigen::Vector2d> > > observations;
+  ObservationMap observations;
 
   // 3d postion of the feature in the world frame.
   Eigen::Vector3d position;
@@ -160,9 +164,314 @@ struct Feature {
 };
 
 typedef Feature::FeatureIDType FeatureIDType;
-typedef std::map<FeatureIDType, Feature, std::less<int>,
-        Eigen::aligned_allocator<
-        std::pair<const FeatureIDType, Feature> > > MapServer;
+
+/*
+ * @brief MapServer Features stored by their ids.
+ * @note The interface follows the std::map it replaces. The
+ *    features are stored contiguously in the order they are
+ *    added, which is the order of their ids as the front end
+ *    numbers them, and an open addressing hash table maps an id
+ *    to its index. Erasing a feature only marks it, and the
+ *    storage is compacted by the bulk erase, or when too many
+ *    features are marked. Unlike std::map, adding a feature or a
+ *    bulk erase may invalidate the iterators and references.
+ *    The id of an element should not be changed through an
+ *    iterator.
+ */
+class MapServer {
+ public:
+  typedef FeatureIDType key_type;
+  typedef Feature mapped_type;
+  typedef std::pair<FeatureIDType, Feature> value_type;
+
+ private:
+  template <bool IsConst>
+  class IteratorBase {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef MapServer::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename std::conditional<IsConst,
+            const value_type*, value_type*>::type pointer;
+    typedef typename std::conditional<IsConst,
+            const value_type&, value_type&>::type reference;
+    typedef typename std::conditional<IsConst,
+            const MapServer*, MapServer*>::type ServerPtr;
+
+    IteratorBase(): server(nullptr), index(0) {}
+    IteratorBase(ServerPtr s, const int& i): server(s), index(i) {
+      skipErased();
+    }
+    // Conversion from iterator to const_iterator.
+    IteratorBase(const IteratorBase<false>& other):
+      server(other.server), index(other.index) {}
+
+    reference operator*() const {
+      return server->values[index];
+    }
+    pointer operator->() const {
+      return &server->values[index];
+    }
+
+    IteratorBase& operator++() {
+      ++index;
+      skipErased();
+      return *this;
+    }
+    IteratorBase operator++(int) {
+      IteratorBase tmp(*this);
+      ++(*this);
+      return tmp;
+    }
+
+    bool operator==(const IteratorBase& other) const {
+      return index == other.index;
+    }
+    bool operator!=(const IteratorBase& other) const {
+      return index != other.index;
+    }
+
+   private:
+    friend class MapServer;
+    friend class IteratorBase<!IsConst>;
+
+    void skipErased() {
+      while (static_cast<size_t>(index) < server->values.size() &&
+          !server->is_alive[index])
+        ++index;
+      return;
+    }
+
+    ServerPtr server;
+    // Index in the storage.
+    int index;
+  };
+
+ public:
+  typedef IteratorBase<false> iterator;
+  typedef IteratorBase<true> const_iterator;
+
+  MapServer(): feature_num(0), table(min_table_size, -1) {}
+
+  size_t size() const {
+    return feature_num;
+  }
+
+  bool empty() const {
+    return feature_num == 0;
+  }
+
+  iterator begin() {
+    return iterator(this, 0);
+  }
+  iterator end() {
+    return iterator(this, values.size());
+  }
+  const_iterator begin() const {
+    return const_iterator(this, 0);
+  }
+  const_iterator end() const {
+    return const_iterator(this, values.size());
+  }
+
+  iterator find(const FeatureIDType& id) {
+    const int index = findIndex(id);
+    return index < 0 ? end() : iterator(this, index);
+  }
+  const_iterator find(const FeatureIDType& id) const {
+    const int index = findIndex(id);
+    return index < 0 ? end() : const_iterator(this, index);
+  }
+
+  size_t count(const FeatureIDType& id) const {
+    return findIndex(id) >= 0 ? 1 : 0;
+  }
+
+  /*
+   * @brief operator[] The feature of an id, which is added as
+   *    Feature() if the id is not stored. Use find() for the
+   *    lookups which should not add a feature.
+   */
+  Feature& operator[](const FeatureIDType& id) {
+    const int index = findIndex(id);
+    if (index >= 0) return values[index].second;
+    return values[append(id, Feature())].second;
+  }
+
+  /*
+   * @brief emplace Add a feature if the id is not stored.
+   * @return The iterator to the feature of the id, and true
+   *    if the feature is added.
+   */
+  std::pair<iterator, bool> emplace(
+      const FeatureIDType& id, const Feature& feature) {
+    const int index = findIndex(id);
+    if (index >= 0) return std::make_pair(iterator(this, index), false);
+    return std::make_pair(iterator(this, append(id, feature)), true);
+  }
+
+  /*
+   * @brief tryEmplace Same as emplace(id, Feature(id)), but the
+   *    feature is only constructed if it is added.
+   */
+  std::pair<iterator, bool> tryEmplace(const FeatureIDType& id) {
+    const int index = findIndex(id);
+    if (index >= 0) return std::make_pair(iterator(this, index), false);
+    return std::make_pair(iterator(this, append(id, Feature(id))), true);
+  }
+
+  /*
+   * @brief erase Remove a feature.
+   * @return The number of removed features.
+   */
+  size_t erase(const FeatureIDType& id) {
+    const int index = findIndex(id);
+    if (index < 0) return 0;
+    is_alive[index] = false;
+    values[index].second = Feature();
+    --feature_num;
+    return 1;
+  }
+
+  /*
+   * @brief erase Remove a batch of features, and compact the
+   *    storage.
+   */
+  void erase(const std::vector<FeatureIDType>& ids) {
+    for (const auto& id : ids) erase(id);
+    compact();
+    return;
+  }
+
+  void clear() {
+    values.clear();
+    is_alive.clear();
+    feature_num = 0;
+    table.assign(min_table_size, -1);
+    return;
+  }
+
+ private:
+  static const int min_table_size = 64;
+
+  // Add a feature whose id is not stored, and return its index.
+  int append(const FeatureIDType& id, const Feature& feature) {
+    // Keep the table at most half full, counting the entries
+    // of the erased features which are yet to be compacted.
+    if (2*(values.size()+1) > table.size()) {
+      if (2*feature_num < values.size()) compact();
+      else rebuildTable(2*table.size());
+    }
+
+    values.push_back(value_type(id, feature));
+    is_alive.push_back(true);
+    ++feature_num;
+    table[freeEntry(id)] = values.size()-1;
+    return values.size()-1;
+  }
+
+  // First entry of an id in the table.
+  int tableEntry(const FeatureIDType& id) const {
+    // Fibonacci hashing spreads the consecutive ids.
+    const unsigned long long hash =
+      static_cast<unsigned long long>(id) * 0x9E3779B97F4A7C15ull;
+    return (hash >> 32) & (table.size()-1);
+  }
+
+  // Index of a stored feature, or -1.
+  int findIndex(const FeatureIDType& id) const {
+    for (int entry = tableEntry(id); table[entry] >= 0;
+        entry = (entry+1) & (table.size()-1)) {
+      const int index = table[entry];
+      if (values[index].first == id && is_alive[index]) return index;
+    }
+    return -1;
+  }
+
+  // First empty entry for an id in the table.
+  int freeEntry(const FeatureIDType& id) const {
+    int entry = tableEntry(id);
+    while (table[entry] >= 0) entry = (entry+1) & (table.size()-1);
+    return entry;
+  }
+
+  void rebuildTable(const int& size) {
+    table.assign(size, -1);
+    for (size_t i = 0; i < values.size(); ++i)
+      table[freeEntry(values[i].first)] = i;
+    return;
+  }
+
+  // Drop the erased features, keeping the order of the rest.
+  void compact() {
+    size_t cntr = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (!is_alive[i]) continue;
+      if (cntr != i) std::swap(values[cntr], values[i]);
+      ++cntr;
+    }
+    values.resize(cntr);
+    is_alive.assign(cntr, true);
+
+    size_t size = min_table_size;
+    while (size < 4*cntr) size *= 2;
+    rebuildTable(size);
+    return;
+  }
+
+  // Features in the order they are added. The capacity is kept
+  // when the features are erased, so the storage is reused.
+  std::vector<value_type, Eigen::aligned_allocator<value_type> > values;
+  std::vector<char> is_alive;
+  size_t feature_num;
+
+  // Index in values of each feature at the entry of its id, or
+  // -1 for an empty entry. The table is a power of two in size.
+  std::vector<int> table;
+};
+
+/*
+ * @brief initializeFeaturePositions Check the motion and
+ *    initialize the 3d positions of a batch of features.
+ * @param feature_ids: IDs of the features to be initialized.
+ * @param cam_states: A map containing the camera poses with its
+ *    ID as the associated key value.
+ * @param thread_pool: Threads to initialize the features in
+ *    parallel. The features are initialized one by one on the
+ *    calling thread if it is null.
+ * @param map_server: Features containing the given IDs. Their
+ *    position and is_initialized are set as in
+ *    Feature::initializePosition().
+ * @return is_valid: One entry per feature id, which is true if
+ *    the feature passes Feature::checkMotion() and the estimated
+ *    3d position is valid.
+ */
+inline void initializeFeaturePositions(
+    const std::vector<FeatureIDType>& feature_ids,
+    const CamStateServer& cam_states, ThreadPool* thread_pool,
+    MapServer& map_server, std::vector<char>& is_valid) {
+  is_valid.assign(feature_ids.size(), false);
+
+  // The poses of the camera states are cached lazily, so they are
+  // brought up to date before the threads read them.
+  for (const auto& item : cam_states) item.second.T_c0_w();
+
+  // Each iteration only touches its own feature and entry of
+  // is_valid, and the map itself is not modified.
+  auto initialize = [&](int i) {
+    Feature& feature = map_server.find(feature_ids[i])->second;
+    is_valid[i] = feature.checkMotion(cam_states) &&
+      feature.initializePosition(cam_states);
+  };
+
+  if (thread_pool) {
+    thread_pool->parallelFor(feature_ids.size(), initialize);
+  } else {
+    for (size_t i = 0; i < feature_ids.size(); ++i) initialize(i);
+  }
+
+  return;
+}
 
 // 利用feature在c0帧的逆深度参数模型，根据c0帧和ci帧间的相对位姿、计算c1帧下feature的重投影误差，并以误差的模平方为返回值。具体参考Eq.(37)的参考文献
 void Feature::cost(const Eigen::Isometry3d& T_c0_ci,
@@ -293,21 +602,13 @@ bool Feature::checkMotion(
     const CamStateServer& cam_states) const {
 
   const StateIDType& first_cam_id = observations.begin()->first;
-  const StateIDType& last_cam_id = (--observations.end())->first;
-
-  Eigen::Isometry3d first_cam_pose;       // QXC：观测到该特征点的首帧位姿
-  const Eigen::Vector4d& first_cam_orientation = cam_states.find(first_cam_id)->second.orientation;
-  first_cam_pose.linear() = Eigen::Quaterniond(
-      first_cam_orientation(3),first_cam_orientation(0),first_cam_orientation(1),first_cam_orientation(2)).toRotationMatrix();
-  first_cam_pose.translation() =
-      cam_states.find(first_cam_id)->second.position;
-
-  Eigen::Isometry3d last_cam_pose;       // QXC：观测到该特征点的末帧位姿
-  const Eigen::Vector4d& last_cam_orientation = cam_states.find(last_cam_id)->second.orientation;
-  last_cam_pose.linear() = Eigen::Quaterniond(
-      last_cam_orientation(3),last_cam_orientation(0),last_cam_orientation(1),last_cam_orientation(2)).toRotationMatrix();
-  last_cam_pose.translation() =
-      cam_states.find(last_cam_id)->second.position;
+  const StateIDType& last_cam_id = (observations.end()-1)->first;
+
+  const Eigen::Isometry3d& first_cam_pose =
+    cam_states.at(first_cam_id).T_c0_w();       // QXC：观测到该特征点的首帧位姿
+
+  const Eigen::Isometry3d& last_cam_pose =
+    cam_states.at(last_cam_id).T_c0_w();       // QXC：观测到该特征点的末帧位姿
 
   // Get the direction of the feature when it is first observed.
   // This direction is represented in the world frame.
@@ -355,13 +656,7 @@ bool Feature::initializePosition(
 
     // This camera pose will take a vector from this camera frame
     // to the world frame.
-    Eigen::Isometry3d cam_pose;
-    const Eigen::Vector4d& cam_qua = cam_state_iter->second.orientation;
-    cam_pose.linear() = Eigen::Quaterniond(
-        cam_qua(3),cam_qua(0),cam_qua(1),cam_qua(2)).toRotationMatrix();
-    cam_pose.translation() = cam_state_iter->second.position;
-
-    cam_poses.push_back(cam_pose);
+    cam_poses.push_back(cam_state_iter->second.T_c0_w());
   }
 
   // All camera poses should be modified such that it takes a
@@ -371,6 +666,14 @@ bool Feature::initializePosition(
   for (auto& pose : cam_poses)
     pose = pose.inverse() * T_c0_w;     // QXC：将所有位姿转换到首帧相机坐标系下（获得相对位姿）
 
+  // Lay out the relative poses and the measurements as arrays,
+  // so that the cost and the normal equations of all the
+  // observations are evaluated in SIMD lanes.
+  TriangulationObservations observation_arrays;
+  observation_arrays.resize(cam_poses.size());
+  for (size_t i = 0; i < cam_poses.size(); ++i)
+    observation_arrays.set(i, cam_poses[i], measurements[i]);
+
   // Generate initial guess
   Eigen::Vector3d initial_position(0.0, 0.0, 0.0);
   generateInitialGuess(cam_poses[cam_poses.size()-1], measurements[0],
@@ -388,34 +691,16 @@ bool Feature::initializePosition(
   double delta_norm = 0;
 
   // Compute the initial cost.      // QXC：这里的cost是feature在观测到它的每一帧的重投影误差，用首帧下的三角化结果（initial guess）以及某帧和首帧间的相对位姿进行投影
-  double total_cost = 0.0;
-  for (int i = 0; i < cam_poses.size(); ++i) {
-    double this_cost = 0.0;
-    cost(cam_poses[i], solution, measurements[i], this_cost);
-    total_cost += this_cost;
-  }
+  double total_cost = triangulationCost(observation_arrays, solution);
 
   // Outer loop.
   do {
-    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
-    Eigen::Vector3d b = Eigen::Vector3d::Zero();
-
-    for (int i = 0; i < cam_poses.size(); ++i) {
-      Eigen::Matrix<double, 2, 3> J;
-      Eigen::Vector2d r;
-      double w;
-
-      jacobian(cam_poses[i], solution, measurements[i], J, r, w);   // QXC：计算当前feature在第i帧的重投影误差关于逆深度参数的Jacobian
-
-      if (w == 1) {
-        A += J.transpose() * J;     // QXC：每个重投影误差为最小二乘累加指标中的一项残差，根据Jacobian的公式，总残差序列的J.trans*J将等于各残差项的j.trans*j之和
-        b += J.transpose() * r;
-      } else {
-        double w_square = w * w;
-        A += w_square * J.transpose() * J;
-        b += w_square * J.transpose() * r;
-      }
-    }
+    // Huber weighted normal equations of all the observations.
+    // See jacobian() for the Jacobian of a single one.
+    Eigen::Matrix3d A;
+    Eigen::Vector3d b;
+    triangulationNormalEquations(observation_arrays, solution,
+        optimization_config.huber_epsilon, A, b);
 
     // Inner loop.
     // Solve for the delta that can reduce the total cost.
@@ -425,12 +710,8 @@ bool Feature::initializePosition(
       Eigen::Vector3d new_solution = solution - delta;
       delta_norm = delta.norm();
 
-      double new_cost = 0.0;
-      for (int i = 0; i < cam_poses.size(); ++i) {
-        double this_cost = 0.0;
-        cost(cam_poses[i], new_solution, measurements[i], this_cost);
-        new_cost += this_cost;
-      }
+      double new_cost = triangulationCost(
+          observation_arrays, new_solution);
 
       if (new_cost < total_cost) {
         is_cost_reduced = true;
@@ -0,0 +1,242 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_GIVENS_UTILS_HPP
+#define MSCKF_VIO_GIVENS_UTILS_HPP
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <Eigen/Dense>
+
+namespace msckf_vio {
+
+/*
+ * @brief nullspaceProjection Project the stacked measurement
+ *    Jacobian and residual of a feature onto the left nullspace
+ *    of its feature Jacobian in place with Givens rotations.
+ * @param H_f: Jacobian w.r.t. the feature position (m x 3). It
+ *    is reduced to upper triangular form on return.
+ * @param H_x: Jacobian w.r.t. the states (m x n).
+ * @param r: Residual (m x 1).
+ * @note On return, the last m-3 rows of H_x and r are A^T*H_x
+ *    and A^T*r, where the columns of A span the left nullspace
+ *    of H_f. This equals the projection with the full U of the
+ *    SVD of H_f up to an orthogonal transform, while neither U
+ *    nor A is formed.
+ */
+template <typename DerivedF, typename DerivedX, typename DerivedR>
+inline void nullspaceProjection(
+    const Eigen::MatrixBase<DerivedF>& H_f_,
+    const Eigen::MatrixBase<DerivedX>& H_x_,
+    const Eigen::MatrixBase<DerivedR>& r_) {
+  Eigen::MatrixBase<DerivedF>& H_f =
+    const_cast<Eigen::MatrixBase<DerivedF>&>(H_f_);
+  Eigen::MatrixBase<DerivedX>& H_x =
+    const_cast<Eigen::MatrixBase<DerivedX>&>(H_x_);
+  Eigen::MatrixBase<DerivedR>& r =
+    const_cast<Eigen::MatrixBase<DerivedR>&>(r_);
+
+  // Zero the feature Jacobian below the diagonal column by
+  // column, from the bottom row upwards. The rows below the
+  // first H_f.cols() ones are left in the nullspace.
+  Eigen::JacobiRotation<double> rotation;
+  for (int col = 0; col < H_f.cols(); ++col) {
+    for (int row = H_f.rows()-1; row > col; --row) {
+      if (H_f(row, col) == 0.0) continue;
+      rotation.makeGivens(H_f(row-1, col), H_f(row, col));
+      H_f.rightCols(H_f.cols()-col).applyOnTheLeft(
+          row-1, row, rotation.adjoint());
+      H_x.applyOnTheLeft(row-1, row, rotation.adjoint());
+      r.applyOnTheLeft(row-1, row, rotation.adjoint());
+      H_f(row, col) = 0.0;
+    }
+  }
+
+  return;
+}
+
+/*
+ * @brief GivensQrAccumulator Fold measurement Jacobians and
+ *    residuals into an upper triangular factor R and Q^T*r with
+ *    row-wise Givens rotations, as they are produced.
+ * @note The memory used is bounded by the state dimension n
+ *    instead of the number of measurement rows. A row is only
+ *    rotated against the rows of R where it is nonzero, and only
+ *    up to the last nonzero column of either row. The stacked
+ *    feature Jacobians only touch the columns of the camera states
+ *    observing the feature, so the zero columns of the IMU state
+ *    and of the other camera states cost nothing.
+ */
+class GivensQrAccumulator {
+ public:
+  GivensQrAccumulator(const int& dim = 0) {
+    reset(dim);
+  }
+
+  /*
+   * @brief reset Clear the accumulated measurements, and set
+   *    the dimension of the state.
+   */
+  void reset(const int& dim) {
+    n = dim;
+    R = RowMajorMatrix::Zero(n, n+1);
+    R_end.assign(n, 0);
+    row.resize(n+1);
+    return;
+  }
+
+  /*
+   * @brief addRows Rotate the rows of a measurement Jacobian
+   *    and residual into R.
+   * @param H: Measurement Jacobian with n columns.
+   * @param r: Residual with as many rows as H.
+   */
+  template <typename DerivedH, typename DerivedR>
+  void addRows(const Eigen::MatrixBase<DerivedH>& H,
+      const Eigen::MatrixBase<DerivedR>& r) {
+    for (int i = 0; i < H.rows(); ++i) {
+      row.head(n) = H.row(i);
+      row(n) = r(i);
+      addRow();
+    }
+    return;
+  }
+
+  /*
+   * @brief addRows Rotate the rows of a measurement Jacobian,
+   *    given by its nonzero columns only, and residual into R.
+   * @param cols: Column of the Jacobian of each column of H.
+   * @param H: Nonzero columns of the measurement Jacobian.
+   * @param r: Residual with as many rows as H.
+   */
+  template <typename DerivedH, typename DerivedR>
+  void addRows(const std::vector<int>& cols,
+      const Eigen::MatrixBase<DerivedH>& H,
+      const Eigen::MatrixBase<DerivedR>& r) {
+    for (int i = 0; i < H.rows(); ++i) {
+      row.setZero();
+      for (size_t j = 0; j < cols.size(); ++j)
+        row(cols[j]) = H(i, j);
+      row(n) = r(i);
+      addRow();
+    }
+    return;
+  }
+
+  /*
+   * @brief rank Number of nonzero rows of R.
+   */
+  int rank() const {
+    int rank = 0;
+    for (int k = 0; k < n; ++k)
+      if (R(k, k) != 0.0) ++rank;
+    return rank;
+  }
+
+  /*
+   * @brief compress Get the compressed measurement Jacobian
+   *    and residual.
+   * @return H_thin: The nonzero rows of R, at most n of them.
+   * @return r_thin: The corresponding entries of Q^T*r.
+   */
+  void compress(Eigen::MatrixXd& H_thin,
+      Eigen::VectorXd& r_thin) const {
+    H_thin.resize(rank(), n);
+    r_thin.resize(H_thin.rows());
+    for (int k = 0, cntr = 0; k < n; ++k) {
+      if (R(k, k) == 0.0) continue;
+      H_thin.row(cntr) = R.row(k).head(n);
+      r_thin(cntr) = R(k, n);
+      ++cntr;
+    }
+    return;
+  }
+
+ private:
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+    Eigen::RowMajor> RowMajorMatrix;
+
+  // Rotate the measurement in row into R.
+  void addRow() {
+    int row_end = n;
+    while (row_end > 0 && row(row_end-1) == 0.0) --row_end;
+
+    for (int k = 0; k < row_end; ++k) {
+      if (row(k) == 0.0) continue;
+
+      // An empty row of R takes the rest of the row as it is.
+      if (R(k, k) == 0.0) {
+        R.row(k).segment(k, row_end-k) = row.segment(k, row_end-k);
+        R(k, n) = row(n);
+        R_end[k] = row_end;
+        return;
+      }
+
+      // Rotate the row against the k-th row of R so that its
+      // k-th entry vanishes. Both rows are zero past their ends.
+      const double rho = std::hypot(R(k, k), row(k));
+      const double c = R(k, k) / rho;
+      const double s = row(k) / rho;
+      const int end = std::max(R_end[k], row_end);
+      double* R_k = R.row(k).data();
+      double* row_k = row.data();
+      for (int j = k+1; j < end; ++j) {
+        const double a = R_k[j];
+        const double b = row_k[j];
+        R_k[j] = c*a + s*b;
+        row_k[j] = c*b - s*a;
+      }
+      const double a = R_k[n];
+      R_k[n] = c*a + s*row_k[n];
+      row_k[n] = c*row_k[n] - s*a;
+
+      R(k, k) = rho;
+      row(k) = 0.0;
+      R_end[k] = end;
+      row_end = end;
+    }
+    return;
+  }
+
+  // Dimension of the state.
+  int n;
+
+  // R and Q^T*r stored side by side in row major order, so
+  // that the rotated rows are contiguous.
+  RowMajorMatrix R;
+
+  // One past the last nonzero column of each row of R, which
+  // stays close to the diagonal for features tracked by
+  // consecutive camera states.
+  std::vector<int> R_end;
+
+  // Buffer of the row being rotated into R.
+  Eigen::RowVectorXd row;
+};
+
+/*
+ * @brief givensQrCompression Compress a tall measurement Jacobian
+ *    and residual with a row-wise Givens QR decomposition.
+ * @param H: Stacked measurement Jacobian (m x n).
+ * @param r: Stacked residual (m x 1).
+ * @return H_thin: The nonzero rows of the triangular factor R of
+ *    H, at most n of them.
+ * @return r_thin: The corresponding entries of Q^T*r.
+ */
+inline void givensQrCompression(
+    const Eigen::MatrixXd& H, const Eigen::VectorXd& r,
+    Eigen::MatrixXd& H_thin, Eigen::VectorXd& r_thin) {
+  GivensQrAccumulator accumulator(H.cols());
+  accumulator.addRows(H, r);
+  accumulator.compress(H_thin, r_thin);
+  return;
+}
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_GIVENS_UTILS_HPP
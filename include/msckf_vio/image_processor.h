@@ -22,6 +22,8 @@
 #include <message_filters/subscriber.h>
 #include <message_filters/time_synchronizer.h>
 
+#include "imu_buffer.hpp"
+
 namespace msckf_vio {
 
 /*
@@ -329,7 +331,9 @@ private:
   cv::Ptr<cv::Feature2D> detector_ptr;
 
   // IMU message buffer.
-  std::vector<sensor_msgs::Imu> imu_msg_buffer;
+  // imuCallback() is the producer of the buffer, and
+  // stereoCallback() is the consumer.
+  ImuBuffer imu_buffer;
 
   // Camera calibration parameters
   std::string cam0_distortion_model;
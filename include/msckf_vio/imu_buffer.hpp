@@ -0,0 +1,223 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_IMU_BUFFER_HPP
+#define MSCKF_VIO_IMU_BUFFER_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <Eigen/Dense>
+
+namespace msckf_vio {
+
+/*
+ * @brief ImuSample The part of an IMU msg used by the filter
+ *    and the image processor.
+ */
+struct ImuSample {
+  double time;
+  Eigen::Vector3d gyro;
+  Eigen::Vector3d acc;
+
+  ImuSample(): time(0.0),
+    gyro(Eigen::Vector3d::Zero()),
+    acc(Eigen::Vector3d::Zero()) {}
+
+  ImuSample(const double& t, const Eigen::Vector3d& g,
+      const Eigen::Vector3d& a): time(t), gyro(g), acc(a) {}
+};
+
+/*
+ * @brief ImuBuffer A fixed capacity ring buffer of IMU samples,
+ *    ordered by the time.
+ * @note The buffer is lock free for a single producer, which
+ *    calls push(), and a single consumer, which calls the other
+ *    functions. The consumer reads the samples in place and
+ *    removes the used ones from the front with pop(), so that
+ *    nothing is copied or shifted. The samples are expected to
+ *    be pushed in increasing order of the time, which the range
+ *    queries rely on.
+ */
+class ImuBuffer {
+ public:
+  /*
+   * @param capacity: Maximum number of the samples, which is
+   *    rounded up to a power of 2. The default keeps about 4s
+   *    of a 1kHz IMU.
+   */
+  ImuBuffer(const size_t& capacity = 4096):
+    head(0), tail(0), dropped_num(0), is_dropping(false) {
+    reset(capacity);
+    return;
+  }
+
+  ImuBuffer(const ImuBuffer&) = delete;
+  ImuBuffer& operator=(const ImuBuffer&) = delete;
+
+  size_t capacity() const {
+    return samples.size();
+  }
+
+  /*
+   * @brief reset Change the capacity and remove all the samples.
+   * @note Not thread safe. It is called before the producer
+   *    starts.
+   */
+  void reset(const size_t& capacity) {
+    size_t slot_num = 1;
+    while (slot_num < capacity) slot_num *= 2;
+    samples.assign(slot_num, ImuSample());
+    follows_gap.assign(slot_num, false);
+    mask = slot_num - 1;
+    head.store(0);
+    tail.store(0);
+    dropped_num.store(0);
+    is_dropping = false;
+    return;
+  }
+
+  /*
+   * @brief push Add the latest sample. Called by the producer.
+   * @return False if the buffer is full, in which case the
+   *    sample is dropped, and the next sample added is marked
+   *    to follow a gap.
+   */
+  bool push(const ImuSample& sample) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t-head.load(std::memory_order_acquire) == samples.size()) {
+      dropped_num.fetch_add(1, std::memory_order_relaxed);
+      is_dropping = true;
+      return false;
+    }
+    samples[t & mask] = sample;
+    follows_gap[t & mask] = is_dropping;
+    is_dropping = false;
+    tail.store(t+1, std::memory_order_release);
+    return true;
+  }
+
+  /*
+   * @brief droppedNum Number of the samples ever dropped
+   *    because the buffer was full.
+   */
+  size_t droppedNum() const {
+    return dropped_num.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * @brief size Number of the samples available to the consumer.
+   *    The producer may add more at any time.
+   */
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) -
+      head.load(std::memory_order_relaxed);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /*
+   * @brief operator[] The i-th oldest sample, i < size().
+   */
+  const ImuSample& operator[](const size_t& i) const {
+    return samples[(head.load(std::memory_order_relaxed)+i) & mask];
+  }
+
+  /*
+   * @brief followsGap Whether some samples were dropped right
+   *    before the i-th oldest sample, i < size().
+   */
+  bool followsGap(const size_t& i) const {
+    return follows_gap[(head.load(std::memory_order_relaxed)+i) & mask];
+  }
+
+  /*
+   * @brief hasGap Whether some samples were dropped before any
+   *    of the samples in [begin, end), end <= size(). The
+   *    samples in the range are then not contiguous with the
+   *    ones before them.
+   */
+  bool hasGap(const size_t& begin, const size_t& end) const {
+    for (size_t i = begin; i < end; ++i)
+      if (followsGap(i)) return true;
+    return false;
+  }
+
+  /*
+   * @brief lowerBound Index of the first sample not earlier than
+   *    the given time, or size() if there is none.
+   */
+  size_t lowerBound(const double& time) const {
+    return partitionPoint(time, false);
+  }
+
+  /*
+   * @brief upperBound Index of the first sample later than the
+   *    given time, or size() if there is none.
+   */
+  size_t upperBound(const double& time) const {
+    return partitionPoint(time, true);
+  }
+
+  /*
+   * @brief pop Remove the n oldest samples, n <= size().
+   */
+  void pop(const size_t& n) {
+    head.store(head.load(std::memory_order_relaxed)+n,
+        std::memory_order_release);
+    return;
+  }
+
+  /*
+   * @brief clear Remove the samples available to the consumer.
+   */
+  void clear() {
+    pop(size());
+    return;
+  }
+
+ private:
+  // Binary search of the first sample later than the time, or
+  // not earlier than the time, over the samples available now.
+  size_t partitionPoint(const double& time, const bool& or_equal) const {
+    size_t first = 0, count = size();
+    while (count > 0) {
+      const size_t step = count / 2;
+      const double& t = (*this)[first+step].time;
+      if (t < time || (or_equal && t == time)) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+  std::vector<ImuSample> samples;
+  // Set for the samples added right after some were dropped.
+  // Written by the producer before the sample is published.
+  std::vector<char> follows_gap;
+  size_t mask;
+
+  // Number of the samples ever removed and added. Only the
+  // consumer changes the head, and only the producer changes
+  // the tail. They are kept on separate cache lines.
+  std::atomic<size_t> head;
+  char head_padding[64];
+  std::atomic<size_t> tail;
+
+  // Only changed by the producer.
+  std::atomic<size_t> dropped_num;
+  bool is_dropping;
+};
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_IMU_BUFFER_HPP
@@ -0,0 +1,242 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_IMU_PREINTEGRATION_HPP
+#define MSCKF_VIO_IMU_PREINTEGRATION_HPP
+
+#include <cmath>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include "math_utils.hpp"
+
+namespace msckf_vio {
+
+/*
+ * @brief so3Exp Rotation matrix of a rotation vector, i.e.
+ *    the matrix exponential of [phi x].
+ */
+inline Eigen::Matrix3d so3Exp(const Eigen::Vector3d& phi) {
+  const double angle = phi.norm();
+  if (angle < 1e-10)
+    return Eigen::Matrix3d::Identity() + skewSymmetric(phi);
+  return Eigen::AngleAxisd(angle, phi/angle).toRotationMatrix();
+}
+
+/*
+ * @brief so3RightJacobian Right Jacobian of SO3, which satisfies
+ *    Exp(phi+dphi) = Exp(phi)*Exp(Jr(phi)*dphi) to the first order.
+ */
+inline Eigen::Matrix3d so3RightJacobian(const Eigen::Vector3d& phi) {
+  const double angle = phi.norm();
+  const Eigen::Matrix3d phi_x = skewSymmetric(phi);
+  if (angle < 1e-5)
+    return Eigen::Matrix3d::Identity() - 0.5*phi_x;
+
+  const double angle2 = angle * angle;
+  return Eigen::Matrix3d::Identity() -
+    (1.0-std::cos(angle))/angle2*phi_x +
+    (angle-std::sin(angle))/(angle2*angle)*phi_x*phi_x;
+}
+
+/*
+ * @brief ImuPreintegration Preintegrated IMU measurements between
+ *    two states, expressed in the IMU frame of the first state.
+ * @note With R_i taking a vector from the IMU frame to the world
+ *    frame at the first state, the second state is
+ *      R_j = R_i*delta_R,
+ *      v_j = v_i + g*dtime + R_i*delta_v,
+ *      p_j = p_i + v_i*dtime + 0.5*g*dtime^2 + R_i*delta_p.
+ *    The mean is integrated with the same 4th order Runge-Kutta
+ *    scheme as the per-sample propagation in MsckfVio, and the
+ *    errors [delta_theta, delta_v, delta_p] are propagated to the
+ *    first order, in the same convention as the IMU error state
+ *    (see imu_propagation.hpp). The biases are the ones used for
+ *    the integration, and the result is corrected to the first
+ *    order for a change of them with the bias Jacobians.
+ */
+class ImuPreintegration {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  ImuPreintegration() {
+    reset(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(),
+        Eigen::Matrix<double, 12, 12>::Zero());
+  }
+
+  /*
+   * @brief reset Start a new preintegration.
+   * @param gyro_bias, acc_bias: Biases to remove from the
+   *    measurements.
+   * @param continuous_noise_cov: Block diagonal covariance of
+   *    the gyro, gyro bias, acc and acc bias noises.
+   */
+  void reset(const Eigen::Vector3d& gyro_bias_,
+      const Eigen::Vector3d& acc_bias_,
+      const Eigen::Matrix<double, 12, 12>& continuous_noise_cov_) {
+    gyro_bias = gyro_bias_;
+    acc_bias = acc_bias_;
+    continuous_noise_cov = continuous_noise_cov_;
+
+    dtime = 0.0;
+    delta_R.setIdentity();
+    delta_v.setZero();
+    delta_p.setZero();
+    bias_jacobian.setZero();
+    noise_cov.setZero();
+    return;
+  }
+
+  /*
+   * @brief integrate Add an IMU measurement, which is assumed to
+   *    be constant over the time interval dt.
+   */
+  void integrate(const double& dt, const Eigen::Vector3d& m_gyro,
+      const Eigen::Vector3d& m_acc) {
+    if (dt <= 0.0) return;
+
+    const Eigen::Vector3d gyro = m_gyro - gyro_bias;
+    const Eigen::Vector3d acc = m_acc - acc_bias;
+
+    // Rotations at the start, the middle and the end of dt.
+    const Eigen::Matrix3d R0 = delta_R;
+    const Eigen::Matrix3d R_half = R0 * so3Exp(0.5*dt*gyro);
+    const Eigen::Matrix3d R1 = R0 * so3Exp(dt*gyro);
+
+    // Errors at the end of dt are A*errors + B*[bias errors]
+    // + B*[gyro and acc noises], with the errors ordered as
+    // [delta_theta, delta_v, delta_p].
+    const Eigen::Matrix3d dR = so3Exp(dt*gyro);
+    const Eigen::Matrix3d R0_acc = R0 * skewSymmetric(acc);
+    Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Identity();
+    A.block<3, 3>(0, 0) = dR.transpose();
+    A.block<3, 3>(3, 0) = -dt * R0_acc;
+    A.block<3, 3>(6, 0) = -0.5*dt*dt * R0_acc;
+    A.block<3, 3>(6, 3) = dt * Eigen::Matrix3d::Identity();
+
+    Eigen::Matrix<double, 9, 6> B = Eigen::Matrix<double, 9, 6>::Zero();
+    B.block<3, 3>(0, 0) = -dt * so3RightJacobian(dt*gyro);
+    B.block<3, 3>(3, 3) = -dt * R0;
+    B.block<3, 3>(6, 3) = -0.5*dt*dt * R0;
+
+    Eigen::Matrix<double, 6, 6> Qd = Eigen::Matrix<double, 6, 6>::Zero();
+    Qd.block<3, 3>(0, 0) = continuous_noise_cov.block<3, 3>(0, 0) / dt;
+    Qd.block<3, 3>(3, 3) = continuous_noise_cov.block<3, 3>(6, 6) / dt;
+
+    noise_cov = A*noise_cov*A.transpose() + B*Qd*B.transpose();
+    bias_jacobian = A*bias_jacobian + B;
+
+    // Propagate the mean. This is the Runge-Kutta step of
+    // MsckfVio::predictNewState() without the gravity, whose
+    // contribution is added when the preintegration is applied.
+    delta_p += dt*delta_v + dt*dt/6.0*(R0+2.0*R_half)*acc;
+    delta_v += dt/6.0*(R0+4.0*R_half+R1)*acc;
+    delta_R = R1;
+
+    dtime += dt;
+    return;
+  }
+
+  /*
+   * @brief correctedDelta Preintegrated measurements corrected
+   *    to the first order for different biases.
+   */
+  void correctedDelta(const Eigen::Vector3d& new_gyro_bias,
+      const Eigen::Vector3d& new_acc_bias,
+      Eigen::Matrix3d& delta_R_corr, Eigen::Vector3d& delta_v_corr,
+      Eigen::Vector3d& delta_p_corr) const {
+    Eigen::Matrix<double, 6, 1> dbias;
+    dbias.head<3>() = new_gyro_bias - gyro_bias;
+    dbias.tail<3>() = new_acc_bias - acc_bias;
+    const Eigen::Matrix<double, 9, 1> correction = bias_jacobian * dbias;
+
+    delta_R_corr = delta_R * so3Exp(correction.segment<3>(0));
+    delta_v_corr = delta_v + correction.segment<3>(3);
+    delta_p_corr = delta_p + correction.segment<3>(6);
+    return;
+  }
+
+  /*
+   * @brief transition Compute the transition matrix and the
+   *    process noise of the IMU error state over the whole
+   *    preintegration.
+   * @param R_w_i: Rotation taking a vector from the world frame
+   *    to the IMU frame at the first state.
+   * @param delta_R_applied, delta_v_applied, delta_p_applied:
+   *    Preintegrated measurements which are applied to the state,
+   *    see correctedDelta().
+   * @return Phi, Q: Same structure as the results of
+   *    imuTransitionMatrix() and imuProcessNoise() for a single
+   *    IMU measurement.
+   */
+  void transition(const Eigen::Matrix3d& R_w_i,
+      const Eigen::Matrix3d& delta_R_applied,
+      const Eigen::Vector3d& delta_v_applied,
+      const Eigen::Vector3d& delta_p_applied,
+      Eigen::Matrix<double, 21, 21>& Phi,
+      Eigen::Matrix<double, 21, 21>& Q) const {
+    const Eigen::Matrix3d R_i_w = R_w_i.transpose();
+
+    Phi.setIdentity();
+    Phi.block<3, 3>(0, 0) = delta_R_applied.transpose();
+    Phi.block<3, 3>(0, 3) = bias_jacobian.block<3, 3>(0, 0);
+
+    Phi.block<3, 3>(6, 0) = -R_i_w * skewSymmetric(delta_v_applied);
+    Phi.block<3, 3>(6, 3) = R_i_w * bias_jacobian.block<3, 3>(3, 0);
+    Phi.block<3, 3>(6, 9) = R_i_w * bias_jacobian.block<3, 3>(3, 3);
+
+    Phi.block<3, 3>(12, 0) = -R_i_w * skewSymmetric(delta_p_applied);
+    Phi.block<3, 3>(12, 3) = R_i_w * bias_jacobian.block<3, 3>(6, 0);
+    Phi.block<3, 3>(12, 6) = dtime * Eigen::Matrix3d::Identity();
+    Phi.block<3, 3>(12, 9) = R_i_w * bias_jacobian.block<3, 3>(6, 3);
+
+    // Rotate the velocity and position errors to the world frame.
+    Eigen::Matrix<double, 9, 9> T = Eigen::Matrix<double, 9, 9>::Identity();
+    T.block<3, 3>(3, 3) = R_i_w;
+    T.block<3, 3>(6, 6) = R_i_w;
+    const Eigen::Matrix<double, 9, 9> noise_cov_w =
+      T * noise_cov * T.transpose();
+
+    // The random walks of the biases are not correlated with
+    // the other errors to keep the preintegration small.
+    Q.setZero();
+    const int rows[3] = {0, 6, 12};
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        Q.block<3, 3>(rows[i], rows[j]) =
+          noise_cov_w.block<3, 3>(3*i, 3*j);
+    Q.block<3, 3>(3, 3) = dtime * continuous_noise_cov.block<3, 3>(3, 3);
+    Q.block<3, 3>(9, 9) = dtime * continuous_noise_cov.block<3, 3>(9, 9);
+
+    return;
+  }
+
+  // Biases removed from the measurements.
+  Eigen::Vector3d gyro_bias;
+  Eigen::Vector3d acc_bias;
+  Eigen::Matrix<double, 12, 12> continuous_noise_cov;
+
+  // Time covered by the preintegration.
+  double dtime;
+
+  // Takes a vector from the IMU frame at the end to the IMU
+  // frame at the start.
+  Eigen::Matrix3d delta_R;
+  Eigen::Vector3d delta_v;
+  Eigen::Vector3d delta_p;
+
+  // Jacobian of [delta_theta, delta_v, delta_p] w.r.t. the
+  // errors of [gyro_bias, acc_bias].
+  Eigen::Matrix<double, 9, 6> bias_jacobian;
+  // Covariance of [delta_theta, delta_v, delta_p] due to the
+  // measurement noises.
+  Eigen::Matrix<double, 9, 9> noise_cov;
+};
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_IMU_PREINTEGRATION_HPP
@@ -0,0 +1,153 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_IMU_PROPAGATION_HPP
+#define MSCKF_VIO_IMU_PROPAGATION_HPP
+
+#include <Eigen/Dense>
+
+#include "math_utils.hpp"
+
+namespace msckf_vio {
+
+/*
+ * The IMU error state is ordered as
+ *    [theta, gyro_bias, velocity, acc_bias, position,
+ *     extrinsic_rotation, extrinsic_translation],
+ * 3 elements each. With this ordering, the continuous
+ * error state dynamics F only has five nonzero 3x3 blocks,
+ *    F(0, 0) = -[gyro x],      F(0, 3) = -I,
+ *    F(6, 0) = -R^T*[acc x],   F(6, 9) = -R^T,
+ *    F(12, 6) = I,
+ * and the noise Jacobian G is block diagonal in its first
+ * 12 rows. The functions below work on these blocks only
+ * instead of forming the dense 21x21 products.
+ */
+
+/*
+ * @brief imuTransitionMatrix Compute the discrete transition
+ *    matrix of the IMU error state by approximating the matrix
+ *    exponential of F*dt to the 3rd order.
+ * @param gyro: Bias free angular velocity.
+ * @param acc: Bias free linear acceleration.
+ * @param R_w_i: Rotation taking a vector from the world frame
+ *    to the IMU frame.
+ * @param dtime: Time interval of the IMU sample.
+ * @return Phi: The discrete transition matrix, which equals to
+ *    I + F*dt + (F*dt)^2/2 + (F*dt)^3/6.
+ */
+inline void imuTransitionMatrix(const Eigen::Vector3d& gyro,
+    const Eigen::Vector3d& acc, const Eigen::Matrix3d& R_w_i,
+    const double& dtime, Eigen::Matrix<double, 21, 21>& Phi) {
+
+  // Nonzero blocks of F*dt. The blocks F(0, 3) and F(12, 6)
+  // are scaled identities and are handled as scalars.
+  const Eigen::Matrix3d A = -skewSymmetric(gyro) * dtime;
+  const Eigen::Matrix3d C = -R_w_i.transpose()*skewSymmetric(acc) * dtime;
+  const Eigen::Matrix3d D = -R_w_i.transpose() * dtime;
+
+  // Powers of the nonzero blocks.
+  const Eigen::Matrix3d A2 = A * A;
+  const Eigen::Matrix3d A3 = A2 * A;
+  const Eigen::Matrix3d CA = C * A;
+  const Eigen::Matrix3d CA2 = CA * A;
+
+  // Only the block rows of orientation, velocity and position
+  // differ from the identity.
+  Phi.setIdentity();
+
+  Phi.block<3, 3>(0, 0) += A + 0.5*A2 + (1.0/6.0)*A3;
+  Phi.block<3, 3>(0, 3) = -dtime*Eigen::Matrix3d::Identity() -
+    0.5*dtime*A - (1.0/6.0)*dtime*A2;
+
+  Phi.block<3, 3>(6, 0) = C + 0.5*CA + (1.0/6.0)*CA2;
+  Phi.block<3, 3>(6, 3) = -0.5*dtime*C - (1.0/6.0)*dtime*CA;
+  Phi.block<3, 3>(6, 9) = D;
+
+  Phi.block<3, 3>(12, 0) = 0.5*dtime*C + (1.0/6.0)*dtime*CA;
+  Phi.block<3, 3>(12, 3) = -(1.0/6.0)*dtime*dtime*C;
+  Phi.block<3, 3>(12, 6) = dtime*Eigen::Matrix3d::Identity();
+  Phi.block<3, 3>(12, 9) = 0.5*dtime*D;
+
+  return;
+}
+
+/*
+ * @brief imuProcessNoise Compute the discrete process noise
+ *    Phi*G*Qc*G^T*Phi^T*dt of the IMU error state.
+ * @param Phi: The discrete transition matrix. Its block rows of
+ *    the biases and the extrinsics should be the identity, and
+ *    its block columns of the extrinsics should be zero above
+ *    the diagonal, as produced by imuTransitionMatrix().
+ * @param R_w_i: Rotation taking a vector from the world frame
+ *    to the IMU frame.
+ * @param continuous_noise_cov: Block diagonal covariance of the
+ *    gyro, gyro bias, acc and acc bias noises.
+ * @param dtime: Time interval of the IMU sample.
+ * @return Q: The discrete process noise. Only the leading 15x15
+ *    block is nonzero.
+ */
+inline void imuProcessNoise(const Eigen::Matrix<double, 21, 21>& Phi,
+    const Eigen::Matrix3d& R_w_i,
+    const Eigen::Matrix<double, 12, 12>& continuous_noise_cov,
+    const double& dtime, Eigen::Matrix<double, 21, 21>& Q) {
+
+  // Phi*G. The noise only enters the first 12 error states,
+  // which only propagate into the first 15 of them.
+  Eigen::Matrix<double, 15, 12> PhiG;
+  PhiG.middleCols<3>(0) = -Phi.block<15, 3>(0, 0);
+  PhiG.middleCols<3>(3) = Phi.block<15, 3>(0, 3);
+  PhiG.middleCols<3>(6).noalias() =
+    -Phi.block<15, 3>(0, 6) * R_w_i.transpose();
+  PhiG.middleCols<3>(9) = Phi.block<15, 3>(0, 9);
+
+  // Phi*G*Qc, using the block diagonal structure of Qc.
+  Eigen::Matrix<double, 15, 12> PhiGQc;
+  for (int i = 0; i < 12; i += 3)
+    PhiGQc.middleCols<3>(i).noalias() = PhiG.middleCols<3>(i) *
+      continuous_noise_cov.block<3, 3>(i, i);
+
+  Q.setZero();
+  Q.topLeftCorner<15, 15>().noalias() =
+    dtime * PhiGQc * PhiG.transpose();
+
+  return;
+}
+
+/*
+ * @brief imuTransitionMultiply Compute Phi*X in place, where
+ *    X has the 21 rows of the IMU error state.
+ * @note Phi should only differ from the identity in the block
+ *    rows of orientation, velocity and position, and only in
+ *    the first 15 columns of them. This holds for the result of
+ *    imuTransitionMatrix() with or without the observability
+ *    constraint, and for any product of such matrices.
+ */
+template <typename Derived>
+inline void imuTransitionMultiply(
+    const Eigen::Matrix<double, 21, 21>& Phi,
+    const Eigen::MatrixBase<Derived>& X_) {
+  Eigen::MatrixBase<Derived>& X =
+    const_cast<Eigen::MatrixBase<Derived>&>(X_);
+
+  Eigen::Matrix<double, 9, Eigen::Dynamic> X_new(9, X.cols());
+  X_new.template middleRows<3>(0).noalias() =
+    Phi.block<3, 15>(0, 0) * X.template topRows<15>();
+  X_new.template middleRows<3>(3).noalias() =
+    Phi.block<3, 15>(6, 0) * X.template topRows<15>();
+  X_new.template middleRows<3>(6).noalias() =
+    Phi.block<3, 15>(12, 0) * X.template topRows<15>();
+
+  X.template middleRows<3>(0) = X_new.template middleRows<3>(0);
+  X.template middleRows<3>(6) = X_new.template middleRows<3>(3);
+  X.template middleRows<3>(12) = X_new.template middleRows<3>(6);
+  return;
+}
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_IMU_PROPAGATION_HPP
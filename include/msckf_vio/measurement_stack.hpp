@@ -0,0 +1,188 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_MEASUREMENT_STACK_HPP
+#define MSCKF_VIO_MEASUREMENT_STACK_HPP
+
+#include <vector>
+#include <utility>
+#include <Eigen/Dense>
+
+#include "givens_utils.hpp"
+
+namespace msckf_vio {
+
+/*
+ * @brief FeatureJacobian Measurement Jacobian and residual of a
+ *    feature after its position is projected out.
+ * @note Only the columns of the camera states observing the
+ *    feature are nonzero, so they are stored compactly. The 6
+ *    columns of the state starting at cam_cols[i] are the columns
+ *    6*i to 6*i+5 of H_c.
+ */
+struct FeatureJacobian {
+  // First column in the state of each camera state.
+  std::vector<int> cam_cols;
+  // Jacobian w.r.t. the camera states (m x 6*cam_cols.size()).
+  Eigen::MatrixXd H_c;
+  // Residual (m x 1).
+  Eigen::VectorXd r;
+
+  int rows() const {
+    return H_c.rows();
+  }
+
+  /*
+   * @brief cols Column in the state of each column of H_c.
+   */
+  std::vector<int> cols() const {
+    std::vector<int> cols(6*cam_cols.size());
+    for (size_t i = 0; i < cols.size(); ++i)
+      cols[i] = cam_cols[i/6] + i%6;
+    return cols;
+  }
+
+  /*
+   * @brief toDense Write the Jacobian into the columns of the
+   *    state of H, which should be zero in the other columns.
+   */
+  template <typename Derived>
+  void toDense(const Eigen::MatrixBase<Derived>& H_) const {
+    Eigen::MatrixBase<Derived>& H =
+      const_cast<Eigen::MatrixBase<Derived>&>(H_);
+    for (size_t i = 0; i < cam_cols.size(); ++i)
+      H.template middleCols<6>(cam_cols[i]) = H_c.middleCols<6>(6*i);
+    return;
+  }
+};
+
+/*
+ * @brief MeasurementStack Collect the Jacobians and residuals of
+ *    the features used in one measurement update.
+ * @note As long as the stacked measurement has no more rows than
+ *    the state, the Jacobians are kept as they are, along with
+ *    their P*H^T products, which the caller computes for the
+ *    measurements that keepsHP() accepts, so that the update
+ *    does not need to compute H*P again. Once there are more
+ *    rows than the state dimension, the measurement is
+ *    compressed with the Givens QR accumulator instead, and the
+ *    cached products are dropped, since H_thin*P is cheaper to
+ *    compute than to rotate along.
+ */
+class MeasurementStack {
+ public:
+  MeasurementStack(const int& dim = 0) {
+    reset(dim);
+  }
+
+  /*
+   * @brief reset Clear the measurements, and set the dimension
+   *    of the state.
+   */
+  void reset(const int& dim) {
+    state_dim = dim;
+    row_num = 0;
+    is_compressed = false;
+    Hs.clear();
+    PHts.clear();
+    accumulator.reset(0);
+    return;
+  }
+
+  /*
+   * @brief addRows Add the measurement of a feature.
+   * @param H: Measurement Jacobian and residual.
+   * @param PHt: P*H^T of the measurement. Only used if
+   *    keepsHP(H.rows()) is true.
+   * @note The measurement and PHt are swapped into the stack,
+   *    and are left empty on return.
+   */
+  void addRows(FeatureJacobian& H, Eigen::MatrixXd& PHt) {
+    if (!is_compressed && row_num+H.rows() > state_dim) {
+      // Fold the measurements kept so far.
+      accumulator.reset(state_dim);
+      for (const auto& H_j : Hs)
+        accumulator.addRows(H_j.cols(), H_j.H_c, H_j.r);
+      Hs.clear();
+      PHts.clear();
+      is_compressed = true;
+    }
+
+    row_num += H.rows();
+    if (is_compressed) {
+      accumulator.addRows(H.cols(), H.H_c, H.r);
+    } else {
+      Hs.push_back(FeatureJacobian());
+      PHts.push_back(Eigen::MatrixXd());
+      std::swap(Hs.back(), H);
+      PHts.back().swap(PHt);
+    }
+    return;
+  }
+
+  /*
+   * @brief keepsHP True if the P*H^T of a measurement with the
+   *    given number of rows, added after the ones so far, would
+   *    be kept, i.e. if it is worth computing.
+   */
+  bool keepsHP(const int& rows) const {
+    return !is_compressed && row_num+rows <= state_dim;
+  }
+
+  /*
+   * @brief hasHP True if H*P of the measurement returned by
+   *    measurement() is available from the P*H^T products added
+   *    with the Jacobians.
+   */
+  bool hasHP() const {
+    return !is_compressed;
+  }
+
+  /*
+   * @brief measurement Get the stacked, or the compressed if
+   *    there are too many rows, measurement Jacobian and residual.
+   * @return HP: H*P of the returned H if hasHP(), otherwise it
+   *    is left untouched.
+   */
+  void measurement(Eigen::MatrixXd& H, Eigen::VectorXd& r,
+      Eigen::MatrixXd& HP) const {
+    if (is_compressed) {
+      accumulator.compress(H, r);
+      return;
+    }
+
+    H = Eigen::MatrixXd::Zero(row_num, state_dim);
+    r.resize(row_num);
+    HP.resize(row_num, state_dim);
+    int row = 0;
+    for (size_t i = 0; i < Hs.size(); ++i) {
+      Hs[i].toDense(H.middleRows(row, Hs[i].rows()));
+      r.segment(row, Hs[i].rows()) = Hs[i].r;
+      HP.middleRows(row, Hs[i].rows()) = PHts[i].transpose();
+      row += Hs[i].rows();
+    }
+    return;
+  }
+
+ private:
+  // Dimension of the state.
+  int state_dim;
+  // Number of the measurement rows added.
+  int row_num;
+  bool is_compressed;
+
+  // Measurements kept as they are.
+  std::vector<FeatureJacobian> Hs;
+  std::vector<Eigen::MatrixXd> PHts;
+
+  // Measurements folded in after there are too many rows.
+  GivensQrAccumulator accumulator;
+};
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_MEASUREMENT_STACK_HPP
@@ -12,11 +12,17 @@
 #include <set>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
 #include <boost/shared_ptr.hpp>
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <ros/spinner.h>
 #include <sensor_msgs/Imu.h>
 #include <nav_msgs/Odometry.h>
 #include <tf/transform_broadcaster.h>
@@ -25,6 +31,10 @@
 #include "imu_state.h"
 #include "cam_state.h"
 #include "feature.hpp"
+#include "thread_pool.hpp"
+#include "measurement_stack.hpp"
+#include "imu_preintegration.hpp"
+#include "imu_buffer.hpp"
 #include <msckf_vio/CameraMeasurement.h>
 
 namespace msckf_vio {
@@ -46,7 +56,12 @@ class MsckfVio {
     MsckfVio operator=(const MsckfVio&) = delete;
 
     // Destructor
-    ~MsckfVio() {}
+    ~MsckfVio() {
+      // Join the callback threads before the members they
+      // use are destroyed.
+      if (imu_spinner) imu_spinner->stop();
+      if (feature_spinner) feature_spinner->stop();
+    }
 
     /*
      * @brief initialize Initialize the VIO.
@@ -72,8 +87,53 @@ class MsckfVio {
       CamStateServer cam_states;
 
       // State covariance matrix
+      // The matrix is allocated once for the maximum number
+      // of camera states. A camera state takes the 6x6 block
+      // starting at 21+6*slot, with its slot in cam_states,
+      // and the rows and columns of the unused slots are kept
+      // zero.
+      // Only the upper triangle of the matrix is maintained.
+      // Use cov() and covBlock() to read it.
       Eigen::MatrixXd state_cov;
       Eigen::Matrix<double, 12, 12> continuous_noise_cov;
+
+      // Product of the IMU transition matrices since the
+      // last image, which are yet to be applied to the cross
+      // covariance between the IMU and the camera states.
+      Eigen::Matrix<double, 21, 21> imu_transition;
+
+      // Symmetric view of the state covariance.
+      Eigen::SelfAdjointView<const Eigen::MatrixXd, Eigen::Upper>
+      cov() const {
+        return state_cov.selfadjointView<Eigen::Upper>();
+      }
+
+      // Copy of a fixed size block of the state covariance.
+      template <int Rows, int Cols>
+      Eigen::Matrix<double, Rows, Cols> covBlock(
+          const int& row, const int& col) const {
+        Eigen::Matrix<double, Rows, Cols> block;
+        for (int j = 0; j < Cols; ++j)
+          for (int i = 0; i < Rows; ++i)
+            block(i, j) = row+i <= col+j ?
+              state_cov(row+i, col+j) : state_cov(col+j, row+i);
+        return block;
+      }
+
+      // Copy of a fixed number of full columns of the state
+      // covariance.
+      template <int Cols>
+      Eigen::Matrix<double, Eigen::Dynamic, Cols> covCols(
+          const int& col) const {
+        const int dim = state_cov.rows();
+        Eigen::Matrix<double, Eigen::Dynamic, Cols> cols(dim, Cols);
+        cols.topRows(col) = state_cov.block<Eigen::Dynamic, Cols>(
+            0, col, col, Cols);
+        cols.template middleRows<Cols>(col) = covBlock<Cols, Cols>(col, col);
+        cols.bottomRows(dim-col-Cols) = state_cov.block<Cols, Eigen::Dynamic>(
+            col, col+Cols, Cols, dim-col-Cols).transpose();
+        return cols;
+      }
     };
 
 
@@ -109,6 +169,24 @@ class MsckfVio {
      */
     void publish(const ros::Time& time);
 
+    /*
+     * @brief bodyPose Convert an IMU state to the pose and
+     *    velocity of the body frame.
+     */
+    void bodyPose(const IMUState& imu_state,
+        Eigen::Isometry3d& T_b_w,
+        Eigen::Vector3d& body_velocity) const;
+
+    // IMU rate odometry
+    // Propagate the IMU rate state with a new IMU msg.
+    void propagateImuRateState(const ImuSample& sample);
+    // Restart the IMU rate state from the filter state, and
+    // propagate it with the IMU msgs still in the buffer.
+    void resetImuRateState();
+    // Publish the odometry of a copy of the IMU rate state.
+    void publishImuRateOdom(const IMUState& imu_state,
+        const ros::Time& time);
+
     /*
      * @brief initializegravityAndBias
      *    Initialize the IMU bias and initial orientation
@@ -135,33 +213,94 @@ class MsckfVio {
         const Eigen::Vector3d& m_acc);
     void predictNewState(const double& dt,
         const Eigen::Vector3d& gyro,
-        const Eigen::Vector3d& acc);
+        const Eigen::Vector3d& acc,
+        IMUState& imu_state) const;
+    // Propogate the state once with the IMU msgs preintegrated
+    // since the last image.
+    void preintegratedProcessModel(const double& time,
+        const ImuPreintegration& preintegration);
+    // Modify the IMU transition matrix so that the
+    // observability matrix has the proper null space.
+    void constrainTransitionMatrix(const double& dtime,
+        Eigen::Matrix<double, 21, 21>& Phi) const;
+    // Propogate the state covariance with the IMU transition
+    // matrix and process noise.
+    void propagateStateCovariance(
+        const Eigen::Matrix<double, 21, 21>& Phi,
+        const Eigen::Matrix<double, 21, 21>& Q);
+    // Apply the IMU transition to the cross covariance
+    // between the IMU and the camera states.
+    void propagateCrossCovariance(
+        const Eigen::Matrix<double, 21, 21>& Phi);
 
     // Measurement update
     void stateAugmentation(const double& time);
     void addFeatureObservations(const CameraMeasurementConstPtr& msg);
     // This function is used to compute the measurement Jacobian
     // for a single feature observed at a single camera frame.
-    void measurementJacobian(const StateIDType& cam_state_id,
+    void measurementJacobian(const CamStateServer& cam_states,
+        const StateIDType& cam_state_id,
         const FeatureIDType& feature_id,
         Eigen::Matrix<double, 4, 6>& H_x,
         Eigen::Matrix<double, 4, 3>& H_f,
-        Eigen::Vector4d& r);
+        Eigen::Vector4d& r) const;
     // This function computes the Jacobian of all measurements viewed
     // in the given camera states of this feature.
-    void featureJacobian(const FeatureIDType& feature_id,
+    void featureJacobian(const CamStateServer& cam_states,
+        const FeatureIDType& feature_id,
         const std::vector<StateIDType>& cam_state_ids,
-        Eigen::MatrixXd& H_x, Eigen::VectorXd& r);
+        FeatureJacobian& H) const;
+    // Jacobian of all the measurements of a lost feature.
+    void lostFeatureJacobian(const CamStateServer& cam_states,
+        const FeatureIDType& feature_id, FeatureJacobian& H) const;
+    // Update with a measurement with at most as many rows as
+    // the state, and its H*P.
     void measurementUpdate(const Eigen::MatrixXd& H,
-        const Eigen::VectorXd& r);
-    bool gatingTest(const Eigen::MatrixXd& H,
-        const Eigen::VectorXd&r, const int& dof);
+        const Eigen::VectorXd& r, const Eigen::MatrixXd& HP);
+    // Update with the measurements stacked for an image.
+    void measurementUpdate(const MeasurementStack& measurements);
+    bool gatingTest(const FeatureJacobian& H, const int& dof) const;
+    // P*H^T of a feature measurement, to be reused in the
+    // measurement update.
+    void covJacobianProduct(const FeatureJacobian& H,
+        Eigen::MatrixXd& PHt) const;
+    /*
+     * @brief findLostFeatures Find the features which are not
+     *    tracked any more, and triangulate the ones which have
+     *    not been initialized.
+     * @param is_tracked: Whether a feature is observed in the
+     *    current image.
+     * @param cam_states: Camera states observing the features.
+     * @return invalid_feature_ids: Lost features which can not
+     *    be used.
+     * @return processed_feature_ids: Lost features to be used,
+     *    in the order of map_server.
+     */
+    void findLostFeatures(
+        const std::function<bool(const Feature&)>& is_tracked,
+        const CamStateServer& cam_states,
+        std::vector<FeatureIDType>& invalid_feature_ids,
+        std::vector<FeatureIDType>& processed_feature_ids);
+    /*
+     * @brief startLostFeatureTask Start finding the lost features
+     *    of an image and computing their Jacobians on a worker
+     *    thread, see pipeline_lost_features.
+     * @note The task reads a copy of the camera states, and reads
+     *    and triangulates the features in map_server, which should
+     *    not be used otherwise until lost_feature_task is joined.
+     */
+    void startLostFeatureTask(const CameraMeasurementConstPtr& msg);
+    void prepareLostFeatures(
+        const std::vector<FeatureIDType>& tracked_feature_ids);
     void removeLostFeatures();
     void findRedundantCamStates(
         std::vector<StateIDType>& rm_cam_state_ids);
     void pruneCamStateBuffer();
     // Reset the system online if the uncertainty is too large.
     void onlineReset();
+    // Remove the camera states and the features, and reset the
+    // state covariance. The IMU state is kept.
+    void resetCamStatesAndCovariance();
 
     // Chi squared test table.
     static std::map<int, double> chi_squared_test_table;
@@ -173,18 +312,27 @@ class MsckfVio {
 
     // Features used
     MapServer map_server;
+    // Ids of the features observed by each camera state,
+    // indexed by the slot of the camera state. A list is
+    // cleared when its camera state is removed, so it may
+    // still hold the features erased from map_server since.
+    std::vector<std::vector<FeatureIDType> > cam_slot_feature_ids;
 
     // IMU data buffer
     // This is buffer is used to handle the unsynchronization or
     // transfer delay between IMU and Image messages.
-    std::vector<sensor_msgs::Imu> imu_msg_buffer;
+    // imuCallback() is the producer of the buffer, and
+    // featureCallback() is the consumer. Its capacity is set
+    // from the IMU rate, and the filter is restarted if the
+    // msgs before an image were dropped while it was full.
+    ImuBuffer imu_buffer;
 
     // Indicate if the gravity vector is set.
-    bool is_gravity_set;
+    std::atomic<bool> is_gravity_set;
 
     // Indicate if the received image is the first one. The
     // system will start after receiving the first image.
-    bool is_first_img;
+    std::atomic<bool> is_first_img;
 
     // The position uncertainty threshold is used to determine
     // when to reset the system online. Otherwise, the ever-
@@ -196,6 +344,78 @@ class MsckfVio {
     // Tracking rate
     double tracking_rate;
 
+    // If set, the cross covariance between the IMU and the
+    // camera states is propagated once per image with the
+    // product of the IMU transition matrices, instead of
+    // once per IMU message.
+    bool defer_cross_cov_propagation;
+
+    // Threads computing the Jacobians and the gating tests of
+    // the lost features. The pool is only created if more than
+    // one thread is used.
+    int feature_jacobian_thread_num;
+    ThreadPool::Ptr thread_pool;
+
+    // If set, the measurements of the lost features and of the
+    // features observed by the pruned camera states are used in
+    // a single update per image, linearized at the same state,
+    // instead of one update each.
+    bool merge_feature_updates;
+    // Measurements of the current image yet to be used.
+    MeasurementStack feature_measurements;
+
+    // If set, the lost features of an image are found from the
+    // msg, triangulated and their Jacobians computed on a worker
+    // thread, while the IMU msgs are processed and the state is
+    // augmented. The gating tests and the update still run after
+    // the new observations are added.
+    bool pipeline_lost_features;
+    std::future<void> lost_feature_task;
+    // The camera states as the task started. The augmentation
+    // may rebuild the lookup table of state_server.cam_states,
+    // so the task does not read it.
+    CamStateServer lost_feature_cam_states;
+    // Results of the task, consumed by removeLostFeatures().
+    std::vector<FeatureIDType> lost_invalid_feature_ids;
+    std::vector<FeatureIDType> lost_feature_ids;
+    std::vector<FeatureJacobian> lost_feature_jacobians;
+
+    // If set, the IMU msgs between two images are preintegrated
+    // and the state and its covariance are propagated once per
+    // image, instead of once per IMU msg.
+    bool use_imu_preintegration;
+
+    // If set, each IMU msg propagates the latest updated state
+    // further, without the covariance, and the result is
+    // published at the IMU rate.
+    bool publish_imu_rate_odom;
+    IMUState imu_rate_state;
+    // Set once imu_rate_state is seeded from an updated state,
+    // and cleared by resetCallback().
+    bool imu_rate_state_valid;
+    // Guards imu_rate_state and imu_rate_state_valid, which are
+    // propagated by imuCallback() and reset by featureCallback().
+    std::mutex imu_rate_state_mutex;
+
+    // If set, the IMU msgs and the features are handled on their
+    // own callback queues, each served by a spinner thread, so
+    // that buffering an IMU msg never waits for an update. The
+    // odometry is published from the feature thread, and the
+    // reset service and the mocap odometry stay on the queue of
+    // the given node handle.
+    bool separate_callback_queues;
+    ros::CallbackQueue imu_callback_queue;
+    ros::CallbackQueue feature_callback_queue;
+    boost::shared_ptr<ros::AsyncSpinner> imu_spinner;
+    boost::shared_ptr<ros::AsyncSpinner> feature_spinner;
+
+    // Guards state_server, map_server and the consumer side of
+    // imu_buffer. It is held by featureCallback() and
+    // resetCallback(), and by imuCallback() only while the
+    // gravity and the bias are initialized. The IMU msgs are
+    // otherwise buffered without it.
+    std::mutex state_mutex;
+
     // Threshold for determine keyframes
     double translation_threshold;
     double rotation_threshold;
@@ -203,11 +423,15 @@ class MsckfVio {
 
     // Ros node handle
     ros::NodeHandle nh;
+    // Copies of nh subscribing on the IMU and the feature queues.
+    ros::NodeHandle imu_nh;
+    ros::NodeHandle feature_nh;
 
     // Subscribers and publishers
     ros::Subscriber imu_sub;
     ros::Subscriber feature_sub;
     ros::Publisher odom_pub;
+    ros::Publisher imu_rate_odom_pub;
     ros::Publisher feature_pub;
     tf::TransformBroadcaster tf_pub;
     ros::ServiceServer reset_srv;
@@ -0,0 +1,179 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_OBSERVATION_MAP_HPP
+#define MSCKF_VIO_OBSERVATION_MAP_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include "imu_state.h"
+
+namespace msckf_vio {
+
+/*
+ * @brief ObservationMap Observations of a feature stored by the
+ *    ids of the camera states, sorted by the ids.
+ * @note The interface follows the std::map it replaces, with
+ *    pointers as the iterators. Up to inline_capacity observations
+ *    are stored in the object itself, and all of them are moved to
+ *    the heap once there are more. The observations are expected
+ *    to be added in increasing order of the ids, which is an
+ *    append, and a lookup first tries the offset of the id from
+ *    the first one before a binary search. Adding or erasing an
+ *    observation invalidates the iterators. The id of an element
+ *    should not be changed through an iterator.
+ */
+class ObservationMap {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef StateIDType key_type;
+  typedef Eigen::Vector4d mapped_type;
+  typedef std::pair<StateIDType, Eigen::Vector4d> value_type;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  static const int inline_capacity = 8;
+
+  ObservationMap(): inline_num(0), is_spilled(false) {}
+
+  size_t size() const {
+    return is_spilled ? spilled.size() : inline_num;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  iterator begin() {
+    return data();
+  }
+  iterator end() {
+    return data() + size();
+  }
+  const_iterator begin() const {
+    return data();
+  }
+  const_iterator end() const {
+    return data() + size();
+  }
+
+  iterator find(const StateIDType& id) {
+    return begin() + findIndex(id);
+  }
+  const_iterator find(const StateIDType& id) const {
+    return begin() + findIndex(id);
+  }
+
+  size_t count(const StateIDType& id) const {
+    return findIndex(id) < size() ? 1 : 0;
+  }
+
+  Eigen::Vector4d& operator[](const StateIDType& id) {
+    // Append the latest observation.
+    if (empty() || end()[-1].first < id)
+      return insert(size(), id)->second;
+
+    const size_t index = lowerBound(id);
+    if (data()[index].first == id) return data()[index].second;
+    return insert(index, id)->second;
+  }
+
+  /*
+   * @brief erase Remove the observation of a camera state.
+   * @return The number of removed observations.
+   */
+  size_t erase(const StateIDType& id) {
+    const size_t index = findIndex(id);
+    if (index == size()) return 0;
+
+    if (is_spilled) {
+      spilled.erase(spilled.begin()+index);
+    } else {
+      std::move(inline_data+index+1, inline_data+inline_num,
+          inline_data+index);
+      --inline_num;
+    }
+    return 1;
+  }
+
+  void clear() {
+    inline_num = 0;
+    is_spilled = false;
+    spilled.clear();
+    return;
+  }
+
+ private:
+  value_type* data() {
+    return is_spilled ? spilled.data() : inline_data;
+  }
+  const value_type* data() const {
+    return is_spilled ? spilled.data() : inline_data;
+  }
+
+  // Index of the first observation whose id is not less than
+  // the given one.
+  size_t lowerBound(const StateIDType& id) const {
+    return std::lower_bound(begin(), end(), id,
+        [](const value_type& item, const StateIDType& id) {
+          return item.first < id; }) - begin();
+  }
+
+  // Index of the observation of an id, or size() if there is
+  // none.
+  size_t findIndex(const StateIDType& id) const {
+    const size_t num = size();
+    if (num == 0) return num;
+
+    // The camera states observing a feature are mostly
+    // consecutive, so the offset of the id is tried first.
+    const StateIDType offset = id - data()[0].first;
+    if (offset >= 0 && static_cast<size_t>(offset) < num &&
+        data()[offset].first == id)
+      return offset;
+
+    const size_t index = lowerBound(id);
+    return index < num && data()[index].first == id ? index : num;
+  }
+
+  // Insert an observation of an id before the given index.
+  value_type* insert(const size_t& index, const StateIDType& id) {
+    if (!is_spilled && inline_num == inline_capacity) {
+      spilled.reserve(2*inline_capacity);
+      spilled.assign(inline_data, inline_data+inline_num);
+      is_spilled = true;
+    }
+
+    if (is_spilled) {
+      spilled.insert(spilled.begin()+index,
+          value_type(id, Eigen::Vector4d::Zero()));
+    } else {
+      std::move_backward(inline_data+index, inline_data+inline_num,
+          inline_data+inline_num+1);
+      inline_data[index] = value_type(id, Eigen::Vector4d::Zero());
+      ++inline_num;
+    }
+    return data() + index;
+  }
+
+  int inline_num;
+  bool is_spilled;
+  value_type inline_data[inline_capacity];
+
+  // All the observations once there are more than
+  // inline_capacity of them.
+  std::vector<value_type, Eigen::aligned_allocator<value_type> > spilled;
+};
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_OBSERVATION_MAP_HPP
@@ -0,0 +1,145 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_THREAD_POOL_HPP
+#define MSCKF_VIO_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+namespace msckf_vio {
+
+/*
+ * @brief ThreadPool A fixed set of worker threads running the
+ *    iterations of a loop in parallel.
+ * @note The thread calling parallelFor() works on the loop as
+ *    well, so a pool of size n starts n-1 threads.
+ */
+class ThreadPool {
+ public:
+  ThreadPool(const int& thread_num):
+    current_task(nullptr), task_num(0), next_task(0), busy_worker_num(0),
+    generation(0), shutdown(false) {
+    for (int i = 1; i < thread_num; ++i)
+      workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    return;
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      shutdown = true;
+    }
+    start_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+    return;
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  typedef boost::shared_ptr<ThreadPool> Ptr;
+
+  /*
+   * @brief size Number of threads working on a loop, including
+   *    the calling thread.
+   */
+  int size() const {
+    return workers.size() + 1;
+  }
+
+  /*
+   * @brief parallelFor Run task(i) for i in [0, n), and return
+   *    after all of them are finished.
+   * @note The order in which the iterations run is not
+   *    specified. The iterations should not write to shared
+   *    data other than their own results.
+   */
+  void parallelFor(const int& n, const std::function<void(int)>& task) {
+    if (n <= 0) return;
+    if (workers.empty() || n == 1) {
+      for (int i = 0; i < n; ++i) task(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      current_task = &task;
+      task_num = n;
+      next_task = 0;
+      busy_worker_num = workers.size();
+      ++generation;
+    }
+    start_cv.notify_all();
+
+    runTasks(task, n);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    done_cv.wait(lock, [this] { return busy_worker_num == 0; });
+    current_task = nullptr;
+    return;
+  }
+
+ private:
+  // Take the iterations of the current loop until all of them
+  // are taken.
+  void runTasks(const std::function<void(int)>& task, const int& n) {
+    for (int i = next_task++; i < n; i = next_task++) task(i);
+    return;
+  }
+
+  void workerLoop() {
+    unsigned long last_generation = 0;
+    while (true) {
+      const std::function<void(int)>* task = nullptr;
+      int n = 0;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        start_cv.wait(lock, [this, &last_generation] {
+            return shutdown || generation != last_generation; });
+        if (shutdown) return;
+        last_generation = generation;
+        task = current_task;
+        n = task_num;
+      }
+
+      runTasks(*task, n);
+
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--busy_worker_num == 0) done_cv.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+
+  std::mutex mtx;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+
+  // The loop being run.
+  const std::function<void(int)>* current_task;
+  int task_num;
+  std::atomic<int> next_task;
+
+  // Number of workers which have not finished the current loop.
+  int busy_worker_num;
+  // Incremented for each loop to wake up the workers.
+  unsigned long generation;
+  bool shutdown;
+};
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_THREAD_POOL_HPP
@@ -0,0 +1,319 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#ifndef MSCKF_VIO_TRIANGULATION_KERNEL_HPP
+#define MSCKF_VIO_TRIANGULATION_KERNEL_HPP
+
+#include <cmath>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define MSCKF_VIO_TRIANGULATION_AVX2
+#include <immintrin.h>
+#endif
+
+namespace msckf_vio {
+
+/*
+ * @brief TriangulationObservations The observations of a feature
+ *    in structure-of-arrays layout, used to evaluate the inverse
+ *    depth cost of Equation (37) in "A Multi-State Constraint
+ *    Kalman Filter for Vision-aided Inertial Navigation" for all
+ *    the observations at once.
+ * @note Each array has one entry per observation. R[3*i+j] holds
+ *    entry (i, j) of the rotation, and t[i] entry i of the
+ *    translation of T_c0_ci, the transformation taking a vector
+ *    from the first camera frame to the camera frame of the
+ *    observation.
+ */
+struct TriangulationObservations {
+  int size() const {
+    return u.size();
+  }
+
+  void resize(const int& n) {
+    for (int i = 0; i < 9; ++i) R[i].resize(n);
+    for (int i = 0; i < 3; ++i) t[i].resize(n);
+    u.resize(n);
+    v.resize(n);
+    return;
+  }
+
+  void set(const int& k, const Eigen::Isometry3d& T_c0_ci,
+      const Eigen::Vector2d& z) {
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j)
+        R[3*i+j][k] = T_c0_ci.linear()(i, j);
+      t[i][k] = T_c0_ci.translation()(i);
+    }
+    u[k] = z(0);
+    v[k] = z(1);
+    return;
+  }
+
+  std::vector<double> R[9];
+  std::vector<double> t[3];
+  std::vector<double> u;
+  std::vector<double> v;
+};
+
+namespace triangulation_kernel {
+
+/*
+ * The kernels accumulate over the observations in [begin, end).
+ * The normal equations are accumulated into A, the 6 entries
+ * (00, 01, 02, 11, 12, 22) of the symmetric 3x3 matrix, and b.
+ */
+
+inline void costScalar(const TriangulationObservations& obs,
+    const Eigen::Vector3d& x, const int& begin, const int& end,
+    double& cost) {
+  const double alpha = x(0), beta = x(1), rho = x(2);
+  for (int k = begin; k < end; ++k) {
+    const double h1 = obs.R[0][k]*alpha + obs.R[1][k]*beta +
+      obs.R[2][k] + rho*obs.t[0][k];
+    const double h2 = obs.R[3][k]*alpha + obs.R[4][k]*beta +
+      obs.R[5][k] + rho*obs.t[1][k];
+    const double h3 = obs.R[6][k]*alpha + obs.R[7][k]*beta +
+      obs.R[8][k] + rho*obs.t[2][k];
+    const double r1 = h1/h3 - obs.u[k];
+    const double r2 = h2/h3 - obs.v[k];
+    cost += r1*r1 + r2*r2;
+  }
+  return;
+}
+
+inline void normalEquationsScalar(const TriangulationObservations& obs,
+    const Eigen::Vector3d& x, const double& huber_epsilon,
+    const int& begin, const int& end, double* A, double* b) {
+  const double alpha = x(0), beta = x(1), rho = x(2);
+  for (int k = begin; k < end; ++k) {
+    const double h1 = obs.R[0][k]*alpha + obs.R[1][k]*beta +
+      obs.R[2][k] + rho*obs.t[0][k];
+    const double h2 = obs.R[3][k]*alpha + obs.R[4][k]*beta +
+      obs.R[5][k] + rho*obs.t[1][k];
+    const double h3 = obs.R[6][k]*alpha + obs.R[7][k]*beta +
+      obs.R[8][k] + rho*obs.t[2][k];
+    const double inv_h3 = 1.0 / h3;
+    const double z1 = h1 * inv_h3;
+    const double z2 = h2 * inv_h3;
+    const double r1 = z1 - obs.u[k];
+    const double r2 = z2 - obs.v[k];
+
+    // J.row(0) = (W.row(0) - z1*W.row(2)) / h3,
+    // J.row(1) = (W.row(1) - z2*W.row(2)) / h3,
+    // with W = [R.col(0), R.col(1), t].
+    const double j00 = (obs.R[0][k] - z1*obs.R[6][k]) * inv_h3;
+    const double j01 = (obs.R[1][k] - z1*obs.R[7][k]) * inv_h3;
+    const double j02 = (obs.t[0][k] - z1*obs.t[2][k]) * inv_h3;
+    const double j10 = (obs.R[3][k] - z2*obs.R[6][k]) * inv_h3;
+    const double j11 = (obs.R[4][k] - z2*obs.R[7][k]) * inv_h3;
+    const double j12 = (obs.t[1][k] - z2*obs.t[2][k]) * inv_h3;
+
+    // Huber weight of the residual.
+    const double e = std::sqrt(r1*r1 + r2*r2);
+    const double w = e <= huber_epsilon ? 1.0 : huber_epsilon / (2*e);
+    const double w2 = w * w;
+
+    A[0] += w2 * (j00*j00 + j10*j10);
+    A[1] += w2 * (j00*j01 + j10*j11);
+    A[2] += w2 * (j00*j02 + j10*j12);
+    A[3] += w2 * (j01*j01 + j11*j11);
+    A[4] += w2 * (j01*j02 + j11*j12);
+    A[5] += w2 * (j02*j02 + j12*j12);
+    b[0] += w2 * (j00*r1 + j10*r2);
+    b[1] += w2 * (j01*r1 + j11*r2);
+    b[2] += w2 * (j02*r1 + j12*r2);
+  }
+  return;
+}
+
+#ifdef MSCKF_VIO_TRIANGULATION_AVX2
+
+__attribute__((target("avx2,fma")))
+inline double horizontalSum(const __m256d& x) {
+  const __m128d sum = _mm_add_pd(
+      _mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+// Same as costScalar(), 4 observations at a time. The remaining
+// observations are left to the caller.
+__attribute__((target("avx2,fma")))
+inline int costAvx2(const TriangulationObservations& obs,
+    const Eigen::Vector3d& x, double& cost) {
+  const __m256d alpha = _mm256_set1_pd(x(0));
+  const __m256d beta = _mm256_set1_pd(x(1));
+  const __m256d rho = _mm256_set1_pd(x(2));
+  __m256d sum = _mm256_setzero_pd();
+
+  const int n = obs.size() / 4 * 4;
+  for (int k = 0; k < n; k += 4) {
+    __m256d h[3];
+    for (int i = 0; i < 3; ++i) {
+      h[i] = _mm256_fmadd_pd(_mm256_loadu_pd(&obs.R[3*i][k]), alpha,
+          _mm256_loadu_pd(&obs.R[3*i+2][k]));
+      h[i] = _mm256_fmadd_pd(_mm256_loadu_pd(&obs.R[3*i+1][k]), beta, h[i]);
+      h[i] = _mm256_fmadd_pd(_mm256_loadu_pd(&obs.t[i][k]), rho, h[i]);
+    }
+    const __m256d r1 = _mm256_sub_pd(_mm256_div_pd(h[0], h[2]),
+        _mm256_loadu_pd(&obs.u[k]));
+    const __m256d r2 = _mm256_sub_pd(_mm256_div_pd(h[1], h[2]),
+        _mm256_loadu_pd(&obs.v[k]));
+    sum = _mm256_fmadd_pd(r1, r1, sum);
+    sum = _mm256_fmadd_pd(r2, r2, sum);
+  }
+
+  cost += horizontalSum(sum);
+  return n;
+}
+
+// Same as normalEquationsScalar(), 4 observations at a time. The
+// remaining observations are left to the caller.
+__attribute__((target("avx2,fma")))
+inline int normalEquationsAvx2(const TriangulationObservations& obs,
+    const Eigen::Vector3d& x, const double& huber_epsilon,
+    double* A, double* b) {
+  const __m256d alpha = _mm256_set1_pd(x(0));
+  const __m256d beta = _mm256_set1_pd(x(1));
+  const __m256d rho = _mm256_set1_pd(x(2));
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d epsilon = _mm256_set1_pd(huber_epsilon);
+  const __m256d half_epsilon = _mm256_set1_pd(0.5*huber_epsilon);
+
+  __m256d A_sum[6], b_sum[3];
+  for (int i = 0; i < 6; ++i) A_sum[i] = _mm256_setzero_pd();
+  for (int i = 0; i < 3; ++i) b_sum[i] = _mm256_setzero_pd();
+
+  const int n = obs.size() / 4 * 4;
+  for (int k = 0; k < n; k += 4) {
+    __m256d R[9], t[3];
+    for (int i = 0; i < 9; ++i) R[i] = _mm256_loadu_pd(&obs.R[i][k]);
+    for (int i = 0; i < 3; ++i) t[i] = _mm256_loadu_pd(&obs.t[i][k]);
+
+    __m256d h[3];
+    for (int i = 0; i < 3; ++i) {
+      h[i] = _mm256_fmadd_pd(R[3*i], alpha, R[3*i+2]);
+      h[i] = _mm256_fmadd_pd(R[3*i+1], beta, h[i]);
+      h[i] = _mm256_fmadd_pd(t[i], rho, h[i]);
+    }
+    const __m256d inv_h3 = _mm256_div_pd(one, h[2]);
+    const __m256d z1 = _mm256_mul_pd(h[0], inv_h3);
+    const __m256d z2 = _mm256_mul_pd(h[1], inv_h3);
+    const __m256d r1 = _mm256_sub_pd(z1, _mm256_loadu_pd(&obs.u[k]));
+    const __m256d r2 = _mm256_sub_pd(z2, _mm256_loadu_pd(&obs.v[k]));
+
+    const __m256d j00 = _mm256_mul_pd(_mm256_fnmadd_pd(z1, R[6], R[0]), inv_h3);
+    const __m256d j01 = _mm256_mul_pd(_mm256_fnmadd_pd(z1, R[7], R[1]), inv_h3);
+    const __m256d j02 = _mm256_mul_pd(_mm256_fnmadd_pd(z1, t[2], t[0]), inv_h3);
+    const __m256d j10 = _mm256_mul_pd(_mm256_fnmadd_pd(z2, R[6], R[3]), inv_h3);
+    const __m256d j11 = _mm256_mul_pd(_mm256_fnmadd_pd(z2, R[7], R[4]), inv_h3);
+    const __m256d j12 = _mm256_mul_pd(_mm256_fnmadd_pd(z2, t[2], t[1]), inv_h3);
+
+    // Huber weight of the residual.
+    const __m256d e = _mm256_sqrt_pd(
+        _mm256_fmadd_pd(r1, r1, _mm256_mul_pd(r2, r2)));
+    const __m256d w = _mm256_blendv_pd(_mm256_div_pd(half_epsilon, e),
+        one, _mm256_cmp_pd(e, epsilon, _CMP_LE_OQ));
+    const __m256d w2 = _mm256_mul_pd(w, w);
+
+    A_sum[0] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j00, j00, _mm256_mul_pd(j10, j10)), A_sum[0]);
+    A_sum[1] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j00, j01, _mm256_mul_pd(j10, j11)), A_sum[1]);
+    A_sum[2] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j00, j02, _mm256_mul_pd(j10, j12)), A_sum[2]);
+    A_sum[3] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j01, j01, _mm256_mul_pd(j11, j11)), A_sum[3]);
+    A_sum[4] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j01, j02, _mm256_mul_pd(j11, j12)), A_sum[4]);
+    A_sum[5] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j02, j02, _mm256_mul_pd(j12, j12)), A_sum[5]);
+    b_sum[0] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j00, r1, _mm256_mul_pd(j10, r2)), b_sum[0]);
+    b_sum[1] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j01, r1, _mm256_mul_pd(j11, r2)), b_sum[1]);
+    b_sum[2] = _mm256_fmadd_pd(w2, _mm256_fmadd_pd(j02, r1, _mm256_mul_pd(j12, r2)), b_sum[2]);
+  }
+
+  for (int i = 0; i < 6; ++i) A[i] += horizontalSum(A_sum[i]);
+  for (int i = 0; i < 3; ++i) b[i] += horizontalSum(b_sum[i]);
+  return n;
+}
+
+#endif // MSCKF_VIO_TRIANGULATION_AVX2
+
+/*
+ * @brief useAvx2 True if the AVX2 kernels are compiled in and
+ *    the CPU running the program supports AVX2 and FMA. The CPU
+ *    is only queried once.
+ */
+inline bool useAvx2() {
+#ifdef MSCKF_VIO_TRIANGULATION_AVX2
+  static const bool is_supported =
+    __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return is_supported;
+#else
+  return false;
+#endif
+}
+
+} // end namespace triangulation_kernel
+
+/*
+ * @brief triangulationCost Compute the sum of the squared
+ *    reprojection errors of all the observations.
+ * @param obs: Observations of the feature.
+ * @param x: Inverse depth parameters [alpha, beta, rho] of the
+ *    feature in the first camera frame.
+ * @param use_simd: Use the AVX2 kernel if the CPU supports it.
+ * @return The total cost, same as summing Feature::cost() over
+ *    the observations up to rounding.
+ */
+inline double triangulationCost(const TriangulationObservations& obs,
+    const Eigen::Vector3d& x, const bool& use_simd = true) {
+  double cost = 0.0;
+  int begin = 0;
+#ifdef MSCKF_VIO_TRIANGULATION_AVX2
+  if (use_simd && obs.size() >= 4 && triangulation_kernel::useAvx2())
+    begin = triangulation_kernel::costAvx2(obs, x, cost);
+#endif
+  triangulation_kernel::costScalar(obs, x, begin, obs.size(), cost);
+  return cost;
+}
+
+/*
+ * @brief triangulationNormalEquations Compute the Huber weighted
+ *    normal equations J^T*W*J and J^T*W*r of all the observations.
+ * @param obs: Observations of the feature.
+ * @param x: Inverse depth parameters [alpha, beta, rho] of the
+ *    feature in the first camera frame.
+ * @param huber_epsilon: Threshold of the Huber kernel.
+ * @param use_simd: Use the AVX2 kernel if the CPU supports it.
+ * @return A, b: Same as accumulating Feature::jacobian() over
+ *    the observations up to rounding.
+ */
+inline void triangulationNormalEquations(
+    const TriangulationObservations& obs, const Eigen::Vector3d& x,
+    const double& huber_epsilon, Eigen::Matrix3d& A, Eigen::Vector3d& b,
+    const bool& use_simd = true) {
+  double A_upper[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  double b_sum[3] = {0.0, 0.0, 0.0};
+  int begin = 0;
+#ifdef MSCKF_VIO_TRIANGULATION_AVX2
+  if (use_simd && obs.size() >= 4 && triangulation_kernel::useAvx2())
+    begin = triangulation_kernel::normalEquationsAvx2(
+        obs, x, huber_epsilon, A_upper, b_sum);
+#endif
+  triangulation_kernel::normalEquationsScalar(
+      obs, x, huber_epsilon, begin, obs.size(), A_upper, b_sum);
+
+  A << A_upper[0], A_upper[1], A_upper[2],
+       A_upper[1], A_upper[3], A_upper[4],
+       A_upper[2], A_upper[4], A_upper[5];
+  b << b_sum[0], b_sum[1], b_sum[2];
+  return;
+}
+
+} // end namespace msckf_vio
+
+#endif // MSCKF_VIO_TRIANGULATION_KERNEL_HPP
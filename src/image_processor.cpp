@@ -294,7 +294,13 @@ void ImageProcessor::imuCallback(
     const sensor_msgs::ImuConstPtr& msg) {
   // Wait for the first image to be set.
   if (is_first_img) return;
-  imu_msg_buffer.push_back(*msg);
+  const ImuSample sample(msg->header.stamp.toSec(),
+      Vector3d(msg->angular_velocity.x, msg->angular_velocity.y,
+        msg->angular_velocity.z),
+      Vector3d(msg->linear_acceleration.x, msg->linear_acceleration.y,
+        msg->linear_acceleration.z));
+  if (!imu_buffer.push(sample))
+    ROS_WARN_THROTTLE(1.0, "IMU buffer is full, dropping IMU msgs...");
   return;
 }
 
@@ -931,32 +937,19 @@ vector<cv::Point2f> ImageProcessor::distortPoints(
 void ImageProcessor::integrateImuData(
     Matx33f& cam0_R_p_c, Matx33f& cam1_R_p_c) {
   // Find the start and the end limit within the imu msg buffer.
-  auto begin_iter = imu_msg_buffer.begin();
-  while (begin_iter != imu_msg_buffer.end()) {
-    if ((begin_iter->header.stamp-
-          cam0_prev_img_ptr->header.stamp).toSec() < -0.01)
-      ++begin_iter;
-    else
-      break;
-  }
-
-  auto end_iter = begin_iter;
-  while (end_iter != imu_msg_buffer.end()) {
-    if ((end_iter->header.stamp-
-          cam0_curr_img_ptr->header.stamp).toSec() < 0.005)
-      ++end_iter;
-    else
-      break;
-  }
+  const size_t begin = imu_buffer.lowerBound(
+      cam0_prev_img_ptr->header.stamp.toSec()-0.01);
+  const size_t end = std::max(begin, imu_buffer.lowerBound(
+      cam0_curr_img_ptr->header.stamp.toSec()+0.005));
 
   // Compute the mean angular velocity in the IMU frame.
   Vec3f mean_ang_vel(0.0, 0.0, 0.0);
-  for (auto iter = begin_iter; iter < end_iter; ++iter)
-    mean_ang_vel += Vec3f(iter->angular_velocity.x,
-        iter->angular_velocity.y, iter->angular_velocity.z);
+  for (size_t i = begin; i < end; ++i)
+    mean_ang_vel += Vec3f(imu_buffer[i].gyro(0),
+        imu_buffer[i].gyro(1), imu_buffer[i].gyro(2));
 
-  if (end_iter-begin_iter > 0)
-    mean_ang_vel *= 1.0f / (end_iter-begin_iter);
+  if (end-begin > 0)
+    mean_ang_vel *= 1.0f / (end-begin);
 
   // Transform the mean angular velocity from the IMU
   // frame to the cam0 and cam1 frames.
@@ -972,7 +965,7 @@ void ImageProcessor::integrateImuData(
   cam1_R_p_c = cam1_R_p_c.t();
 
   // Delete the useless and used imu messages.
-  imu_msg_buffer.erase(imu_msg_buffer.begin(), end_iter);
+  imu_buffer.pop(end);
   return;
 }
 
@@ -13,8 +13,6 @@
 
 #include <Eigen/SVD>
 #include <Eigen/QR>
-#include <Eigen/SparseCore>
-#include <Eigen/SPQRSupport>
 #include <boost/math/distributions/chi_squared.hpp>
 
 #include <eigen_conversions/eigen_msg.h>
@@ -25,6 +23,8 @@
 
 #include <msckf_vio/msckf_vio.h>
 #include <msckf_vio/math_utils.hpp>
+#include <msckf_vio/givens_utils.hpp>
+#include <msckf_vio/imu_propagation.hpp>
 #include <msckf_vio/utils.h>
 
 using namespace std;
@@ -53,6 +53,7 @@ map<int, double> MsckfVio::chi_squared_test_table;
 MsckfVio::MsckfVio(ros::NodeHandle& pnh):
   is_gravity_set(false),
   is_first_img(true),
+  imu_rate_state_valid(false),
   nh(pnh) {
   return;
 }
@@ -70,6 +71,30 @@ bool MsckfVio::loadParameters() {
   nh.param<double>("translation_threshold", translation_threshold, 0.4);
   nh.param<double>("tracking_rate_threshold", tracking_rate_threshold, 0.5);
 
+  nh.param<bool>("defer_cross_cov_propagation",
+      defer_cross_cov_propagation, false);
+  nh.param<int>("feature_jacobian_thread_num",
+      feature_jacobian_thread_num, 1);
+  nh.param<bool>("merge_feature_updates",
+      merge_feature_updates, false);
+  nh.param<bool>("use_imu_preintegration",
+      use_imu_preintegration, false);
+  nh.param<bool>("publish_imu_rate_odom",
+      publish_imu_rate_odom, false);
+  nh.param<bool>("separate_callback_queues",
+      separate_callback_queues, false);
+  nh.param<bool>("pipeline_lost_features",
+      pipeline_lost_features, false);
+
+  // The IMU buffer keeps the msgs of the given duration, so
+  // that the feature thread may fall behind that long before
+  // any msg is dropped.
+  double imu_rate, imu_buffer_duration;
+  nh.param<double>("imu_rate", imu_rate, 200.0);
+  nh.param<double>("imu_buffer_duration", imu_buffer_duration, 20.0);
+  imu_buffer.reset(static_cast<size_t>(
+        std::ceil(imu_rate*imu_buffer_duration)));
+
   // Feature optimization parameters
   nh.param<double>("feature/config/translation_threshold",
       Feature::optimization_config.translation_threshold, 0.2);
@@ -117,7 +142,13 @@ bool MsckfVio::loadParameters() {
   nh.param<double>("initial_covariance/extrinsic_translation_cov",
       extrinsic_translation_cov, 1e-4);
 
-  state_server.state_cov = MatrixXd::Zero(21, 21);
+  // Maximum number of camera states to be stored
+  nh.param<int>("max_cam_state_size", max_cam_state_size, 30);
+
+  // The covariance matrix is allocated for the maximum number
+  // of camera states once, so that the filter never resizes it.
+  state_server.state_cov = MatrixXd::Zero(
+      21+6*max_cam_state_size, 21+6*max_cam_state_size);
   for (int i = 3; i < 6; ++i)
     state_server.state_cov(i, i) = gyro_bias_cov;
   for (int i = 6; i < 9; ++i)
@@ -129,6 +160,11 @@ bool MsckfVio::loadParameters() {
   for (int i = 18; i < 21; ++i)
     state_server.state_cov(i, i) = extrinsic_translation_cov;
 
+  // A slot of the camera states for each covariance block.
+  state_server.cam_states = CamStateServer(max_cam_state_size);
+  cam_slot_feature_ids.assign(max_cam_state_size,
+      vector<FeatureIDType>(0));
+
   // Transformation offsets between the frames involved.
   Isometry3d T_imu_cam0 = utils::getTransformEigen(nh, "cam0/T_cam_imu");
   Isometry3d T_cam0_imu = T_imu_cam0.inverse();
@@ -140,9 +176,6 @@ bool MsckfVio::loadParameters() {
   IMUState::T_imu_body =
     utils::getTransformEigen(nh, "T_imu_body").inverse();
 
-  // Maximum number of camera states to be stored
-  nh.param<int>("max_cam_state_size", max_cam_state_size, 30);
-
   ROS_INFO("===========================================");
   ROS_INFO("fixed frame id: %s", fixed_frame_id.c_str());
   ROS_INFO("child frame id: %s", child_frame_id.c_str());
@@ -152,6 +185,22 @@ bool MsckfVio::loadParameters() {
   ROS_INFO("Keyframe rotation threshold: %f", rotation_threshold);
   ROS_INFO("Keyframe translation threshold: %f", translation_threshold);
   ROS_INFO("Keyframe tracking rate threshold: %f", tracking_rate_threshold);
+  ROS_INFO("defer cross covariance propagation: %d",
+      defer_cross_cov_propagation);
+  ROS_INFO("feature jacobian thread #: %d",
+      feature_jacobian_thread_num);
+  ROS_INFO("merge feature updates: %d",
+      merge_feature_updates);
+  ROS_INFO("use imu preintegration: %d",
+      use_imu_preintegration);
+  ROS_INFO("publish imu rate odom: %d",
+      publish_imu_rate_odom);
+  ROS_INFO("separate callback queues: %d",
+      separate_callback_queues);
+  ROS_INFO("pipeline lost features: %d",
+      pipeline_lost_features);
+  ROS_INFO("imu buffer capacity: %lu",
+      static_cast<unsigned long>(imu_buffer.capacity()));
   ROS_INFO("gyro noise: %.10f", IMUState::gyro_noise);
   ROS_INFO("gyro bias noise: %.10f", IMUState::gyro_bias_noise);
   ROS_INFO("acc noise: %.10f", IMUState::acc_noise);
@@ -182,19 +231,39 @@ bool MsckfVio::createRosIO() {
   odom_pub = nh.advertise<nav_msgs::Odometry>("odom", 10);	// QXC：开始发布名为odom的topic，其消息类型为nav_msgs::Odometry，最大缓存为10
   feature_pub = nh.advertise<sensor_msgs::PointCloud2>(		// QXC：开始发布名为feature_point_cloud的topic，其消息类型为sensor_msgs::PointCloud2，
       "feature_point_cloud", 10);				            //	    最大缓存为10
+  if (publish_imu_rate_odom)
+    imu_rate_odom_pub = nh.advertise<nav_msgs::Odometry>(
+        "imu_rate_odom", 100);
 
   reset_srv = nh.advertiseService("reset",
       &MsckfVio::resetCallback, this);
 
-  imu_sub = nh.subscribe("imu", 100,				// QXC：开始订阅名为imu的topic，最大缓存为100
+  imu_nh = nh;
+  feature_nh = nh;
+  if (separate_callback_queues) {
+    imu_nh.setCallbackQueue(&imu_callback_queue);
+    feature_nh.setCallbackQueue(&feature_callback_queue);
+  }
+
+  imu_sub = imu_nh.subscribe("imu", 100,				// QXC：开始订阅名为imu的topic，最大缓存为100
       &MsckfVio::imuCallback, this);
-  feature_sub = nh.subscribe("features", 40,			// QXC：开始订阅名为features的topic，最大缓存为40
+  feature_sub = feature_nh.subscribe("features", 40,		// QXC：开始订阅名为features的topic，最大缓存为40
       &MsckfVio::featureCallback, this);
 
   mocap_odom_sub = nh.subscribe("mocap_odom", 10,		// QXC：开始订阅名为mocap_odom的topic，最大缓存为10
       &MsckfVio::mocapOdomCallback, this);
   mocap_odom_pub = nh.advertise<nav_msgs::Odometry>("gt_odom", 1);	// QXC：开始发布名为gt_odom的topic，其消息类型为nav_msgs::Odometry，最大缓存为1
 
+  // One thread for each queue. More threads would not help,
+  // since the msgs on a queue are processed in order.
+  if (separate_callback_queues) {
+    imu_spinner.reset(new ros::AsyncSpinner(1, &imu_callback_queue));
+    feature_spinner.reset(
+        new ros::AsyncSpinner(1, &feature_callback_queue));
+    imu_spinner->start();
+    feature_spinner->start();
+  }
+
   return true;
 }
 
@@ -214,6 +283,7 @@ bool MsckfVio::initialize() {
     Matrix3d::Identity()*IMUState::acc_noise;
   state_server.continuous_noise_cov.block<3, 3>(9, 9) =
     Matrix3d::Identity()*IMUState::acc_bias_noise;
+  state_server.imu_transition.setIdentity();
 
   // Initialize the chi squared test table with confidence
   // level 0.95.
@@ -223,6 +293,10 @@ bool MsckfVio::initialize() {
       boost::math::quantile(chi_squared_dist, 0.05);
   }
 
+  // Start the threads working on the lost features.
+  if (feature_jacobian_thread_num > 1)
+    thread_pool.reset(new ThreadPool(feature_jacobian_thread_num));
+
   if (!createRosIO()) return false;
   ROS_INFO("Finish creating ROS IO...");
 
@@ -237,15 +311,36 @@ void MsckfVio::imuCallback(
   // being processed immediately. The IMU msgs are processed
   // when the next image is available, in which way, we can
   // easily handle the transfer delay.
-  imu_msg_buffer.push_back(*msg);
+  const ImuSample sample(msg->header.stamp.toSec(),
+      Vector3d(msg->angular_velocity.x, msg->angular_velocity.y,
+        msg->angular_velocity.z),
+      Vector3d(msg->linear_acceleration.x, msg->linear_acceleration.y,
+        msg->linear_acceleration.z));
+  if (!imu_buffer.push(sample))
+    ROS_WARN_THROTTLE(1.0, "IMU buffer is full, dropping IMU msgs...");
 
   if (!is_gravity_set) {
-    if (imu_msg_buffer.size() < 200) return;	// QXC：IMU数据不足200条时不对重力和bias进行初始化
-    //if (imu_msg_buffer.size() < 10) return;
+    if (imu_buffer.size() < 200) return;	// QXC：IMU数据不足200条时不对重力和bias进行初始化
+    //if (imu_buffer.size() < 10) return;
+    std::lock_guard<std::mutex> state_lock(state_mutex);
     initializeGravityAndBias();		// QXC：进行初始化的IMU数据必须是静止时采集的
     is_gravity_set = true;
   }
 
+  // Forward propagate the latest corrected state with the
+  // msg, and publish it right away. Nothing is published
+  // until the first update has seeded the state.
+  if (publish_imu_rate_odom) {
+    IMUState imu_state;
+    {
+      std::lock_guard<std::mutex> imu_rate_lock(imu_rate_state_mutex);
+      if (!imu_rate_state_valid) return;
+      propagateImuRateState(sample);
+      imu_state = imu_rate_state;
+    }
+    publishImuRateOdom(imu_state, msg->header.stamp);
+  }
+
   return;
 }
 
@@ -257,24 +352,21 @@ void MsckfVio::initializeGravityAndBias() {
   Vector3d sum_angular_vel = Vector3d::Zero();
   Vector3d sum_linear_acc = Vector3d::Zero();
 
-  for (const auto& imu_msg : imu_msg_buffer) {
-    Vector3d angular_vel = Vector3d::Zero();
-    Vector3d linear_acc = Vector3d::Zero();
-
-    tf::vectorMsgToEigen(imu_msg.angular_velocity, angular_vel);	// QXC：该函数来自<eigen_conversions/eigen_msg.h>
-    tf::vectorMsgToEigen(imu_msg.linear_acceleration, linear_acc);
-
-    sum_angular_vel += angular_vel;
-    sum_linear_acc += linear_acc;
+  // This is called by the only producer of the buffer, and
+  // the consumer does not use it before the gravity is set.
+  const size_t imu_sample_num = imu_buffer.size();
+  for (size_t i = 0; i < imu_sample_num; ++i) {
+    sum_angular_vel += imu_buffer[i].gyro;
+    sum_linear_acc += imu_buffer[i].acc;
   }
 
   state_server.imu_state.gyro_bias =
-    sum_angular_vel / imu_msg_buffer.size();
+    sum_angular_vel / imu_sample_num;
   //IMUState::gravity =
-  //  -sum_linear_acc / imu_msg_buffer.size();
+  //  -sum_linear_acc / imu_sample_num;
   // This is the gravity in the IMU frame.
   Vector3d gravity_imu =
-    sum_linear_acc / imu_msg_buffer.size();
+    sum_linear_acc / imu_sample_num;
 
   // Initialize the initial orientation, so that the estimation
   // is consistent with the inertial frame.
@@ -300,6 +392,9 @@ bool MsckfVio::resetCallback(
   feature_sub.shutdown();
   imu_sub.shutdown();
 
+  // Wait for an update in progress on the feature thread.
+  std::lock_guard<std::mutex> state_lock(state_mutex);
+
   // Reset the IMU state.
   IMUState& imu_state = state_server.imu_state;
   imu_state.time = 0.0;
@@ -314,6 +409,7 @@ bool MsckfVio::resetCallback(
 
   // Remove all existing camera states.
   state_server.cam_states.clear();
+  for (auto& feature_ids : cam_slot_feature_ids) feature_ids.clear();
 
   // Reset the state covariance.
   double gyro_bias_cov, acc_bias_cov, velocity_cov;
@@ -330,7 +426,7 @@ bool MsckfVio::resetCallback(
   nh.param<double>("initial_covariance/extrinsic_translation_cov",
       extrinsic_translation_cov, 1e-4);
 
-  state_server.state_cov = MatrixXd::Zero(21, 21);
+  state_server.state_cov.setZero();
   for (int i = 3; i < 6; ++i)
     state_server.state_cov(i, i) = gyro_bias_cov;
   for (int i = 6; i < 9; ++i)
@@ -342,20 +438,26 @@ bool MsckfVio::resetCallback(
   for (int i = 18; i < 21; ++i)
     state_server.state_cov(i, i) = extrinsic_translation_cov;
 
+  state_server.imu_transition.setIdentity();
+
   // Clear all exsiting features in the map.
   map_server.clear();
 
   // Clear the IMU msg buffer.
-  imu_msg_buffer.clear();
+  imu_buffer.clear();
 
   // Reset the starting flags.
   is_gravity_set = false;
   is_first_img = true;
+  {
+    std::lock_guard<std::mutex> imu_rate_lock(imu_rate_state_mutex);
+    imu_rate_state_valid = false;
+  }
 
   // Restart the subscribers.
-  imu_sub = nh.subscribe("imu", 100,
+  imu_sub = imu_nh.subscribe("imu", 100,
       &MsckfVio::imuCallback, this);            // QXC：重新开始订阅imu消息
-  feature_sub = nh.subscribe("features", 40,
+  feature_sub = feature_nh.subscribe("features", 40,
       &MsckfVio::featureCallback, this);        // QXC：重新开始订阅feature消息
 
   // TODO: When can the reset fail?
@@ -370,6 +472,10 @@ bool MsckfVio::resetCallback(
 void MsckfVio::featureCallback(
     const CameraMeasurementConstPtr& msg) {
 
+  // Hold the state for the whole update. imuCallback() keeps
+  // buffering the IMU msgs meanwhile.
+  std::lock_guard<std::mutex> state_lock(state_mutex);
+
   // Return if the gravity vector has not been set.
   if (!is_gravity_set) return;		// QXC：IMU姿态初始化之前不处理feature消息
 
@@ -381,10 +487,34 @@ void MsckfVio::featureCallback(
     state_server.imu_state.time = msg->header.stamp.toSec();
   }
 
+  // The IMU msgs up to the image are not contiguous if some
+  // were dropped while the buffer was full. The state is not
+  // propagated across the gap. The filter is restarted from
+  // the image instead, as in onlineReset().
+  const size_t imu_begin =
+    imu_buffer.lowerBound(state_server.imu_state.time);
+  const size_t imu_end = std::max(imu_begin,
+      imu_buffer.upperBound(msg->header.stamp.toSec()));
+  if (imu_buffer.hasGap(imu_begin, imu_end)) {
+    ROS_WARN("IMU msgs before the image were dropped (%lu in total), "
+        "restarting the filter...",
+        static_cast<unsigned long>(imu_buffer.droppedNum()));
+    resetCamStatesAndCovariance();
+    state_server.imu_state.time = msg->header.stamp.toSec();
+    imu_buffer.pop(imu_end);
+    if (publish_imu_rate_odom) resetImuRateState();
+    return;
+  }
+
   static double max_processing_time = 0.0;
   static int critical_time_cntr = 0;
   double processing_start_time = ros::Time::now().toSec();
 
+  // The lost features are known from the msg already, and
+  // are prepared while the IMU state is propagated and
+  // the state is augmented.
+  if (pipeline_lost_features) startLostFeatureTask(msg);
+
   // Propogate the IMU state.
   // that are received before the image msg.
   ros::Time start_time = ros::Time::now();
@@ -398,6 +528,9 @@ void MsckfVio::featureCallback(
   double state_augmentation_time = (
       ros::Time::now()-start_time).toSec();
 
+  // The features are changed from here on.
+  if (lost_feature_task.valid()) lost_feature_task.get();
+
   // Add new observations for existing features or new
   // features in the map server.
   start_time = ros::Time::now();
@@ -425,6 +558,9 @@ void MsckfVio::featureCallback(
   // Reset the system if necessary.
   onlineReset();                                    // QXC：根据IMU状态位置协方差判断是否重置整个系统
 
+  // Restart the IMU rate propagation from the updated state.
+  if (publish_imu_rate_odom) resetImuRateState();
+
   double processing_end_time = ros::Time::now().toSec();
   double processing_time =
     processing_end_time - processing_start_time;
@@ -518,36 +654,48 @@ void MsckfVio::mocapOdomCallback(
 
 // 对上一帧图像之前最后一条IMU数据之后的，当前帧图像时刻之前的IMU数据进行惯性递推解算，同时更新状态协方差矩阵
 void MsckfVio::batchImuProcessing(const double& time_bound) {
-  // Counter how many IMU msgs in the buffer are used.
-  int used_imu_msg_cntr = 0;
+  // The msgs are only accumulated here in the preintegration
+  // mode, and the state is propagated once afterwards.
+  ImuPreintegration preintegration;
+  double preintegration_time = state_server.imu_state.time;
+  if (use_imu_preintegration)
+    preintegration.reset(state_server.imu_state.gyro_bias,
+        state_server.imu_state.acc_bias,
+        state_server.continuous_noise_cov);
+
+  // The IMU msgs earlier than the state are skipped, and the
+  // ones up to the image are used.
+  const size_t begin = imu_buffer.lowerBound(state_server.imu_state.time);
+  const size_t end = std::max(begin, imu_buffer.upperBound(time_bound));
+
+  for (size_t i = begin; i < end; ++i) {
+    const ImuSample& imu_sample = imu_buffer[i];
 
-  for (const auto& imu_msg : imu_msg_buffer) {
-    double imu_time = imu_msg.header.stamp.toSec();
-    if (imu_time < state_server.imu_state.time) {
-      ++used_imu_msg_cntr;
-      continue;
+    // Execute process model.
+    if (use_imu_preintegration) {
+      preintegration.integrate(imu_sample.time-preintegration_time,
+          imu_sample.gyro, imu_sample.acc);
+      preintegration_time = imu_sample.time;
+    } else {
+      processModel(imu_sample.time, imu_sample.gyro, imu_sample.acc);      // QXC：注意这个函数是递推一条IMI数据，而不是递推一系列（整个for循环实现递推一系列）
     }
-    if (imu_time > time_bound) break;
-
-    // QXC：注意，在首次处理feature而调用本函数时，time_bound与state_server.imu_state.time相等，
-      //    因此上述两个if将会漏掉一种极端情况，即某条IMU数据时间戳正好和feature时间戳相等，但这种情况下，根据processModel的分析，将不会进行任何递推
+  }
 
-    // Convert the msgs.
-    Vector3d m_gyro, m_acc;
-    tf::vectorMsgToEigen(imu_msg.angular_velocity, m_gyro);         // QXC：tf系列函数来自ros自身
-    tf::vectorMsgToEigen(imu_msg.linear_acceleration, m_acc);
+  if (use_imu_preintegration)
+    preintegratedProcessModel(preintegration_time, preintegration);
 
-    // Execute process model.
-    processModel(imu_time, m_gyro, m_acc);      // QXC：注意这个函数是递推一条IMI数据，而不是递推一系列（整个for循环实现递推一系列）
-    ++used_imu_msg_cntr;
+  // Bring the cross covariance up to date before the
+  // new camera state is augmented.
+  if (defer_cross_cov_propagation) {
+    propagateCrossCovariance(state_server.imu_transition);
+    state_server.imu_transition.setIdentity();
   }
 
   // Set the state ID for the new IMU state.
   state_server.imu_state.id = IMUState::next_id++;
 
   // Remove all used IMU msgs.
-  imu_msg_buffer.erase(imu_msg_buffer.begin(),
-      imu_msg_buffer.begin()+used_imu_msg_cntr);
+  imu_buffer.pop(end);
 
   return;
 }
@@ -564,37 +712,85 @@ void MsckfVio::processModel(const double& time,
   Vector3d acc = m_acc - imu_state.acc_bias;		// QXC：在没开始滤波之前，acc_bias始终是0
   double dtime = time - imu_state.time;		// QXC：两个IMU测量之间的时间间隔（除了在第一帧之后的第一条IMU数据，此时算出的是和第一帧之间的时间差）
 
-  // Compute discrete transition and noise covariance matrix
-  Matrix<double, 21, 21> F = Matrix<double, 21, 21>::Zero();
-  Matrix<double, 21, 12> G = Matrix<double, 21, 12>::Zero();
-
-  F.block<3, 3>(0, 0) = -skewSymmetric(gyro);
-  F.block<3, 3>(0, 3) = -Matrix3d::Identity();
-  F.block<3, 3>(6, 0) = -quaternionToRotation(
-      imu_state.orientation).transpose()*skewSymmetric(acc);
-  F.block<3, 3>(6, 9) = -quaternionToRotation(		// QXC：注意！！这里的F阵中没有考虑地球自转！！！
-      imu_state.orientation).transpose();
-  F.block<3, 3>(12, 6) = Matrix3d::Identity();
-
-  G.block<3, 3>(0, 0) = -Matrix3d::Identity();
-  G.block<3, 3>(3, 3) = Matrix3d::Identity();
-  G.block<3, 3>(6, 6) = -quaternionToRotation(
-      imu_state.orientation).transpose();
-  G.block<3, 3>(9, 9) = Matrix3d::Identity();
-
+  // Compute discrete transition matrix.
   // Approximate matrix exponential to the 3rd order,
   // which can be considered to be accurate enough assuming
-  // dtime is within 0.01s.
-  Matrix<double, 21, 21> Fdt = F * dtime;
-  Matrix<double, 21, 21> Fdt_square = Fdt * Fdt;
-  Matrix<double, 21, 21> Fdt_cube = Fdt_square * Fdt;
-  Matrix<double, 21, 21> Phi = Matrix<double, 21, 21>::Identity() +
-    Fdt + 0.5*Fdt_square + (1.0/6.0)*Fdt_cube;
+  // dtime is within 0.01s. See imu_propagation.hpp for the
+  // block structure of F and G that is used here.
+  const Matrix3d R_w_i = quaternionToRotation(imu_state.orientation);   // QXC：注意！！这里的F阵中没有考虑地球自转！！！
+  Matrix<double, 21, 21> Phi;
+  imuTransitionMatrix(gyro, acc, R_w_i, dtime, Phi);
 
   // Propogate the state using 4th order Runge-Kutta
-  predictNewState(dtime, gyro, acc);
+  predictNewState(dtime, gyro, acc, imu_state);
 
   // Modify the transition matrix	// QXC：这部分完全没看懂
+  constrainTransitionMatrix(dtime, Phi);
+
+  // Propogate the state covariance matrix.
+  Matrix<double, 21, 21> Q;
+  imuProcessNoise(Phi, R_w_i, state_server.continuous_noise_cov,
+      dtime, Q);        // QXC：用常值矩阵模型估算Q阵，Q=Phi*G*q*G^T*Phi^T*dt
+  propagateStateCovariance(Phi, Q);
+
+  // Update the state correspondes to null space.	// QXC：这样看来，这个所谓的null space不过就是保存上一时刻的状态罢了。。
+  imu_state.orientation_null = imu_state.orientation;
+  imu_state.position_null = imu_state.position;
+  imu_state.velocity_null = imu_state.velocity;
+
+  // Update the state info
+  state_server.imu_state.time = time;       // QXC：imu状态时间更新到递推完的这条IMU数据时间
+  return;
+}
+
+void MsckfVio::preintegratedProcessModel(const double& time,
+    const ImuPreintegration& preintegration) {
+
+  IMUState& imu_state = state_server.imu_state;
+  const double& dtime = preintegration.dtime;
+  if (dtime <= 0.0) {
+    imu_state.time = time;
+    return;
+  }
+
+  // The biases have not changed since the preintegration
+  // started in batchImuProcessing(), so the correction is
+  // only needed if the preintegration is done earlier.
+  Matrix3d delta_R;
+  Vector3d delta_v, delta_p;
+  preintegration.correctedDelta(imu_state.gyro_bias,
+      imu_state.acc_bias, delta_R, delta_v, delta_p);
+
+  const Matrix3d R_w_i = quaternionToRotation(imu_state.orientation);
+  Matrix<double, 21, 21> Phi, Q;
+  preintegration.transition(R_w_i, delta_R, delta_v, delta_p, Phi, Q);
+
+  // Propogate the state over the whole preintegration.
+  const Matrix3d R_i_w = R_w_i.transpose();
+  imu_state.orientation = rotationToQuaternion(
+      delta_R.transpose()*R_w_i);
+  quaternionNormalize(imu_state.orientation);
+  imu_state.position += imu_state.velocity*dtime +
+    0.5*dtime*dtime*IMUState::gravity + R_i_w*delta_p;
+  imu_state.velocity += dtime*IMUState::gravity + R_i_w*delta_v;
+
+  // Propogate the state covariance matrix.
+  constrainTransitionMatrix(dtime, Phi);
+  propagateStateCovariance(Phi, Q);
+
+  // Update the state correspondes to null space.
+  imu_state.orientation_null = imu_state.orientation;
+  imu_state.position_null = imu_state.position;
+  imu_state.velocity_null = imu_state.velocity;
+
+  imu_state.time = time;
+  return;
+}
+
+void MsckfVio::constrainTransitionMatrix(const double& dtime,
+    Matrix<double, 21, 21>& Phi) const {
+
+  const IMUState& imu_state = state_server.imu_state;
   Matrix3d R_kk_1 = quaternionToRotation(imu_state.orientation_null);
   Phi.block<3, 3>(0, 0) =
     quaternionToRotation(imu_state.orientation) * R_kk_1.transpose();	// QXC：这么一改，相当于F矩阵对角线上首个3*3矩阵压根没用了
@@ -612,42 +808,46 @@ void MsckfVio::processModel(const double& time,
       dtime*imu_state.velocity_null+imu_state.position_null-
       imu_state.position) * IMUState::gravity;
   Phi.block<3, 3>(12, 0) = A2 - (A2*u-w2)*s;	// QXC：同上
+  return;
+}
 
-  // Propogate the state covariance matrix.
-  Matrix<double, 21, 21> Q = Phi*G*state_server.continuous_noise_cov*
-    G.transpose()*Phi.transpose()*dtime;        // QXC：用常值矩阵模型估算Q阵，Q=Phi*G*q*
-  state_server.state_cov.block<21, 21>(0, 0) =
-    Phi*state_server.state_cov.block<21, 21>(0, 0)*Phi.transpose() + Q;
-
-  if (state_server.cam_states.size() > 0) {	// QXC：当状态量扩维了相机状态时，还需要更新扩维的P阵
-    state_server.state_cov.block(	// QXC：block(i,j,p,q)函数表示从矩阵的第i行第j列元素开始，取p行，q列
-        0, 21, 21, state_server.state_cov.cols()-21) =
-      Phi * state_server.state_cov.block(
-        0, 21, 21, state_server.state_cov.cols()-21);
-    state_server.state_cov.block(
-        21, 0, state_server.state_cov.rows()-21, 21) =
-      state_server.state_cov.block(
-        21, 0, state_server.state_cov.rows()-21, 21) * Phi.transpose();
+void MsckfVio::propagateStateCovariance(
+    const Matrix<double, 21, 21>& Phi,
+    const Matrix<double, 21, 21>& Q) {
+
+  // Only the upper triangle of the covariance is written, which
+  // keeps it symmetric without an extra pass over the matrix.
+  const Matrix<double, 21, 21> P11 =
+    state_server.covBlock<21, 21>(0, 0);
+  state_server.state_cov.topLeftCorner<21, 21>().triangularView<Upper>() =
+    Phi*P11*Phi.transpose() + Q;
+
+  if (defer_cross_cov_propagation) {
+    // Only accumulate the transition here. It is applied to
+    // the cross covariance before the next state augmentation.
+    imuTransitionMultiply(Phi, state_server.imu_transition);
+  } else if (state_server.cam_states.size() > 0) {	// QXC：当状态量扩维了相机状态时，还需要更新扩维的P阵
+    propagateCrossCovariance(Phi);
   }
+  return;
+}
 
-  MatrixXd state_cov_fixed = (state_server.state_cov +		// QXC：保持对称性
-      state_server.state_cov.transpose()) / 2.0;
-  state_server.state_cov = state_cov_fixed;
+// 将IMU状态转移矩阵作用到IMU与cam状态间的互协方差上
+void MsckfVio::propagateCrossCovariance(
+    const Matrix<double, 21, 21>& Phi) {
 
-  // Update the state correspondes to null space.	// QXC：这样看来，这个所谓的null space不过就是保存上一时刻的状态罢了。。
-  imu_state.orientation_null = imu_state.orientation;
-  imu_state.position_null = imu_state.position;
-  imu_state.velocity_null = imu_state.velocity;
-
-  // Update the state info
-  state_server.imu_state.time = time;       // QXC：imu状态时间更新到递推完的这条IMU数据时间
+  // The cross covariance is entirely in the upper triangle.
+  MatrixXd& P = state_server.state_cov;
+  imuTransitionMultiply(Phi,
+      P.block(0, 21, 21, P.cols()-21));	// QXC：block(i,j,p,q)函数表示从矩阵的第i行第j列元素开始，取p行，q列
   return;
 }
 
 // 进行惯性递推，其中姿态四元数采用毕卡法更新，速度和位置采用匀加速度假设的4阶LK法
 void MsckfVio::predictNewState(const double& dt,
     const Vector3d& gyro,
-    const Vector3d& acc) {
+    const Vector3d& acc,
+    IMUState& imu_state) const {
 
   // TODO: Will performing the forward integration using
   //    the inverse of the quaternion give better accuracy?
@@ -657,9 +857,9 @@ void MsckfVio::predictNewState(const double& dt,
   Omega.block<3, 1>(0, 3) = gyro;
   Omega.block<1, 3>(3, 0) = -gyro;
 
-  Vector4d& q = state_server.imu_state.orientation;
-  Vector3d& v = state_server.imu_state.velocity;
-  Vector3d& p = state_server.imu_state.position;
+  Vector4d& q = imu_state.orientation;
+  Vector3d& v = imu_state.velocity;
+  Vector3d& p = imu_state.position;
 
   // Some pre-calculation
   Vector4d dq_dt, dq_dt2;
@@ -723,8 +923,9 @@ void MsckfVio::stateAugmentation(const double& time) {
   Vector3d t_c_w = state_server.imu_state.position +
     R_w_i.transpose()*t_c_i;
 
-  state_server.cam_states[state_server.imu_state.id] =
-    CAMState(state_server.imu_state.id);
+  // The new camera state takes a free slot, which is also its
+  // block in the covariance matrix. There is always one since
+  // the number of camera states never exceeds max_cam_state_size.
   CAMState& cam_state = state_server.cam_states[
     state_server.imu_state.id];
 
@@ -734,6 +935,7 @@ void MsckfVio::stateAugmentation(const double& time) {
 
   cam_state.orientation_null = cam_state.orientation;
   cam_state.position_null = cam_state.position;
+  cam_state.updatePoseCache();
 
   // Update the covariance matrix of the state.
   // To simplify computation, the matrix J below is the nontrivial block
@@ -747,28 +949,23 @@ void MsckfVio::stateAugmentation(const double& time) {
   J.block<3, 3>(3, 12) = Matrix3d::Identity();
   J.block<3, 3>(3, 18) = Matrix3d::Identity();		// QXC：这里是关于p_c_i的Jacobian，恐怕不对，应当是R_w_i.transpose()
 
-  // Resize the state covariance matrix.
-  size_t old_rows = state_server.state_cov.rows();
-  size_t old_cols = state_server.state_cov.cols();
-  state_server.state_cov.conservativeResize(old_rows+6, old_cols+6);
-
   // Rename some matrix blocks for convenience.
-  const Matrix<double, 21, 21>& P11 =
-    state_server.state_cov.block<21, 21>(0, 0);
-  const MatrixXd& P12 =
-    state_server.state_cov.block(0, 21, 21, old_cols-21);
-
-  // Fill in the augmented state covariance.
-  state_server.state_cov.block(old_rows, 0, 6, old_cols) << J*P11, J*P12;	// QXC：PIC（的转置）最初是由J*PIIkk计算得到的。类似测量值与状态的协方差
-  state_server.state_cov.block(0, old_cols, old_rows, 6) =
-    state_server.state_cov.block(old_rows, 0, 6, old_cols).transpose();
-  state_server.state_cov.block<6, 6>(old_rows, old_cols) =
-    J * P11 * J.transpose();
-
-  // Fix the covariance to be symmetric
-  MatrixXd state_cov_fixed = (state_server.state_cov +
-      state_server.state_cov.transpose()) / 2.0;
-  state_server.state_cov = state_cov_fixed;
+  MatrixXd& P = state_server.state_cov;
+  const int state_size = P.rows();
+  const int cam_index = 21 + 6*state_server.cam_states.slot(
+      state_server.imu_state.id);
+
+  // Fill in the augmented state covariance. The rows and columns
+  // of the new slot are all zero at this point. The new rows are
+  // computed in full first, and the part of them that lies in the
+  // lower triangle is then moved into the new columns.
+  const Matrix<double, 21, 21> P11 = state_server.covBlock<21, 21>(0, 0);
+  P.block<6, 21>(cam_index, 0).noalias() = J * P11;	// QXC：PIC（的转置）最初是由J*PIIkk计算得到的。类似测量值与状态的协方差
+  P.block(cam_index, 21, 6, state_size-21).noalias() =
+    J * P.block(0, 21, 21, state_size-21);
+  P.block(0, cam_index, cam_index, 6) =
+    P.block(cam_index, 0, 6, cam_index).transpose();
+  P.block<6, 6>(cam_index, cam_index) = J * P11 * J.transpose();
 
   return;
 }
@@ -781,22 +978,24 @@ void MsckfVio::addFeatureObservations(
   int curr_feature_num = map_server.size();
   int tracked_feature_num = 0;
 
+  // The current camera state is a new one, whose list in the
+  // inverted index is empty.
+  vector<FeatureIDType>& observed_feature_ids =
+    cam_slot_feature_ids[state_server.cam_states.slot(state_id)];
+  observed_feature_ids.reserve(msg->features.size());
+
   // Add new observations for existing features or new
   // features in the map server.
   for (const auto& feature : msg->features) {
-    if (map_server.find(feature.id) == map_server.end()) {	// QXC：视觉前端处理应当是将所有的特征都编号了，如果没有和原来的匹配结果，就新增一个编号
-      // This is a new feature.
-      map_server[feature.id] = Feature(feature.id);
-      map_server[feature.id].observations[state_id] =
-        Vector4d(feature.u0, feature.v0,
-            feature.u1, feature.v1);    // QXC：本工程为双目方式
-    } else {
-      // This is an old feature.
-      map_server[feature.id].observations[state_id] =
-        Vector4d(feature.u0, feature.v0,
-            feature.u1, feature.v1);
-      ++tracked_feature_num;
-    }
+    // A new feature is added, or an old one is found, with a
+    // single lookup.
+    const auto result = map_server.tryEmplace(
+        feature.id);	// QXC：视觉前端处理应当是将所有的特征都编号了，如果没有和原来的匹配结果，就新增一个编号
+    result.first->second.observations[state_id] =
+      Vector4d(feature.u0, feature.v0,
+          feature.u1, feature.v1);    // QXC：本工程为双目方式
+    if (!result.second) ++tracked_feature_num;
+    observed_feature_ids.push_back(feature.id);
   }
 
   tracking_rate =					// QXC：跟踪率，表示旧的特征点被跟踪上的比例
@@ -808,22 +1007,23 @@ void MsckfVio::addFeatureObservations(
 
 // 求观测关于cam误差状态（姿态误差角、位置）和feature位置的Jacobian（根据文献TR_MSCKF），并对获得的Jacobian进行修改以满足可观性要求（根据文献OC-VINS）
 void MsckfVio::measurementJacobian(
+    const CamStateServer& cam_states,
     const StateIDType& cam_state_id,
     const FeatureIDType& feature_id,
-    Matrix<double, 4, 6>& H_x, Matrix<double, 4, 3>& H_f, Vector4d& r) {
+    Matrix<double, 4, 6>& H_x, Matrix<double, 4, 3>& H_f, Vector4d& r) const {
 
   // Prepare all the required data.
-  const CAMState& cam_state = state_server.cam_states[cam_state_id];
-  const Feature& feature = map_server[feature_id];
+  const CAMState& cam_state = cam_states.at(cam_state_id);
+  const Feature& feature = map_server.find(feature_id)->second;
 
   // Cam0 pose.
-  Matrix3d R_w_c0 = quaternionToRotation(cam_state.orientation);
+  const Matrix3d& R_w_c0 = cam_state.R_w_c0();
   const Vector3d& t_c0_w = cam_state.position;
 
   // Cam1 pose.
   Matrix3d R_c0_c1 = CAMState::T_cam0_cam1.linear();
-  Matrix3d R_w_c1 = CAMState::T_cam0_cam1.linear() * R_w_c0;
-  Vector3d t_c1_w = t_c0_w - R_w_c1.transpose()*CAMState::T_cam0_cam1.translation();  // QXC：T_cam0_cam1表示c1系下c0的位置
+  const Matrix3d& R_w_c1 = cam_state.R_w_c1();
+  const Vector3d& t_c1_w = cam_state.t_c1_w();  // QXC：T_cam0_cam1表示c1系下c0的位置
 
   // 3d feature position in the world frame.
   // And its observation with the stereo cameras.
@@ -882,11 +1082,12 @@ void MsckfVio::measurementJacobian(
 
 // 求指定的feature的观测关于能观测到它的所有cam的状态及feature位置的Jacobian，并进行null space投影使得feature位置被marginalize掉
 void MsckfVio::featureJacobian(
+    const CamStateServer& cam_states,
     const FeatureIDType& feature_id,
     const std::vector<StateIDType>& cam_state_ids,
-    MatrixXd& H_x, VectorXd& r) {
+    FeatureJacobian& H) const {
 
-  const auto& feature = map_server[feature_id];
+  const auto& feature = map_server.find(feature_id)->second;
 
   // Check how many camera states in the provided camera
   // id camera has actually seen this feature.
@@ -901,8 +1102,11 @@ void MsckfVio::featureJacobian(
   int jacobian_row_size = 0;
   jacobian_row_size = 4 * valid_cam_state_ids.size();   // QXC：这是文献TR_MSCKF中式22的行（双目情形），还未进行null space marginalization
 
-  MatrixXd H_xj = MatrixXd::Zero(jacobian_row_size,
-      21+state_server.cam_states.size()*6);
+  // The Jacobian w.r.t. the camera states is stacked compactly,
+  // 6 columns per valid camera state, and kept so after the
+  // projection.
+  MatrixXd H_cj = MatrixXd::Zero(jacobian_row_size,
+      6*valid_cam_state_ids.size());
   MatrixXd H_fj = MatrixXd::Zero(jacobian_row_size, 3);
   VectorXd r_j = VectorXd::Zero(jacobian_row_size);
   int stack_cntr = 0;
@@ -912,81 +1116,76 @@ void MsckfVio::featureJacobian(
     Matrix<double, 4, 6> H_xi = Matrix<double, 4, 6>::Zero();
     Matrix<double, 4, 3> H_fi = Matrix<double, 4, 3>::Zero();
     Vector4d r_i = Vector4d::Zero();
-    measurementJacobian(cam_id, feature.id, H_xi, H_fi, r_i);   // QXC：计算测量值关于cam状态和feature位置的Jacobian，同时做关于可观性的修正
-
-    auto cam_state_iter = state_server.cam_states.find(cam_id);
-    int cam_state_cntr = std::distance(
-        state_server.cam_states.begin(), cam_state_iter);     // QXC：可见TR_MSCKF式22中的cam位姿包括了所有被增广的cam
+    measurementJacobian(cam_states, cam_id, feature.id, H_xi, H_fi, r_i);   // QXC：计算测量值关于cam状态和feature位置的Jacobian，同时做关于可观性的修正
 
     // Stack the Jacobians.
-    H_xj.block<4, 6>(stack_cntr, 21+6*cam_state_cntr) = H_xi;
+    H_cj.block<4, 6>(stack_cntr, stack_cntr/4*6) = H_xi;
     H_fj.block<4, 3>(stack_cntr, 0) = H_fi;
     r_j.segment<4>(stack_cntr) = r_i;
     stack_cntr += 4;
   }
 
   // Project the residual and Jacobians onto the nullspace
-  // of H_fj.
-  JacobiSVD<MatrixXd> svd_helper(H_fj, ComputeFullU | ComputeThinV);
-  MatrixXd A = svd_helper.matrixU().rightCols(
-      jacobian_row_size - 3);
+  // of H_fj with Givens rotations, which leaves the result
+  // in the last jacobian_row_size-3 rows.
+  nullspaceProjection(H_fj, H_cj, r_j);     // QXC：本句参照Mour07式23和24，与SVD求左零空间的结果只差一个正交变换
 
-  H_x = A.transpose() * H_xj;     // QXC：本句和下一句参照Mour07式23和24
-  r = A.transpose() * r_j;
+  H.cam_cols.resize(valid_cam_state_ids.size());
+  for (int i = 0; i < valid_cam_state_ids.size(); ++i)
+    H.cam_cols[i] = 21 + 6*cam_states.slot(valid_cam_state_ids[i]);     // QXC：可见TR_MSCKF式22中的cam位姿包括了所有被增广的cam
+  H.H_c = H_cj.bottomRows(jacobian_row_size-3);
+  H.r = r_j.tail(jacobian_row_size-3);
 
   return;
 }
 
 // 根据Mour07中III-E部分进行MSCKF的测量更新，首先利用QR分解将观测残差方程进一步降维，然后根据新残差方程计算卡尔曼增益，进行IMU状态、cam状态以及P阵更新
 void MsckfVio::measurementUpdate(
-    const MatrixXd& H, const VectorXd& r) {
-
-  if (H.rows() == 0 || r.rows() == 0) return;
-
-  // Decompose the final Jacobian matrix to reduce computational
-  // complexity as in Equation (28), (29).
-  MatrixXd H_thin;
-  VectorXd r_thin;
-
-  if (H.rows() > H.cols()) {    // QXC：H阵行数超过列数时，才通过H阵的QR分解降维（H的列数是受IMU状态数和cam状态上限限制的，不会过多）
-    // Convert H to a sparse matrix.
-    SparseMatrix<double> H_sparse = H.sparseView();
-
-    // Perform QR decompostion on H_sparse.
-    SPQR<SparseMatrix<double> > spqr_helper;
-    spqr_helper.setSPQROrdering(SPQR_ORDERING_NATURAL);
-    spqr_helper.compute(H_sparse);
-
-    MatrixXd H_temp;
-    VectorXd r_temp;
-    (spqr_helper.matrixQ().transpose() * H).evalTo(H_temp);
-    (spqr_helper.matrixQ().transpose() * r).evalTo(r_temp);
-
-    H_thin = H_temp.topRows(21+state_server.cam_states.size()*6);       // QXC：为什么只取前(21+6N)行呢？
-    r_thin = r_temp.head(21+state_server.cam_states.size()*6);
-
-    //HouseholderQR<MatrixXd> qr_helper(H);
-    //MatrixXd Q = qr_helper.householderQ();
-    //MatrixXd Q1 = Q.leftCols(21+state_server.cam_states.size()*6);
+    const MeasurementStack& measurements) {
+
+  MatrixXd H_x;
+  VectorXd r;
+  MatrixXd HP;
+  measurements.measurement(H_x, r, HP);
+
+  // H*P is only known from the P*H^T products stacked with
+  // the Jacobians before the measurement is compressed.
+  if (measurements.hasHP())
+    measurementUpdate(H_x, r, HP);
+  else
+    measurementUpdate(H_x, r, H_x*state_server.cov());
+  return;
+}
 
-    //H_thin = Q1.transpose() * H;
-    //r_thin = Q1.transpose() * r;
-  } else {
-    H_thin = H;
-    r_thin = r;
+void MsckfVio::measurementUpdate(const MatrixXd& H_thin,
+    const VectorXd& r_thin, const MatrixXd& HP) {
+
+  if (H_thin.rows() == 0 || r_thin.rows() == 0) return;
+
+  // Compute the Kalman gain K = P*H^T*S^-1 in factored form.
+  // With S = L*L^T and M = L^-1*H*P, K = M^T*L^-1, and the
+  // covariance update P-K*H*P becomes P-M^T*M.
+  MatrixXd S = Feature::observation_noise*MatrixXd::Identity(
+      H_thin.rows(), H_thin.rows());
+  S.triangularView<Lower>() += HP * H_thin.transpose();
+  //MatrixXd K_transpose = S.fullPivHouseholderQr().solve(HP);
+  const LLT<MatrixXd> S_llt(S);
+  // S is positive definite in theory. Skip the update if the
+  // factorization fails numerically rather than apply a gain
+  // from a broken factor.
+  if (S_llt.info() != Eigen::Success) {
+    ROS_WARN("Innovation covariance is not positive definite, "
+        "skipping the update...");
+    return;
   }
 
-  // Compute the Kalman gain.
-  const MatrixXd& P = state_server.state_cov;
-  MatrixXd S = H_thin*P*H_thin.transpose() +
-      Feature::observation_noise*MatrixXd::Identity(
-        H_thin.rows(), H_thin.rows());
-  //MatrixXd K_transpose = S.fullPivHouseholderQr().solve(H_thin*P);
-  MatrixXd K_transpose = S.ldlt().solve(H_thin*P);
-  MatrixXd K = K_transpose.transpose();
+  MatrixXd M = HP;
+  S_llt.matrixL().solveInPlace(M);
+  VectorXd r_whiten = r_thin;
+  S_llt.matrixL().solveInPlace(r_whiten);
 
   // Compute the error of the state.
-  VectorXd delta_x = K * r_thin;
+  VectorXd delta_x = M.transpose() * r_whiten;
 
   // Update the IMU state.
   const VectorXd& delta_x_imu = delta_x.head<21>();
@@ -1018,43 +1217,61 @@ void MsckfVio::measurementUpdate(
   state_server.imu_state.t_cam0_imu += delta_x_imu.segment<3>(18);
 
   // Update the camera states.
-  auto cam_state_iter = state_server.cam_states.begin();
-  for (int i = 0; i < state_server.cam_states.size();
-      ++i, ++cam_state_iter) {
-    const VectorXd& delta_x_cam = delta_x.segment<6>(21+i*6);
+  for (auto iter = state_server.cam_states.begin();
+      iter != state_server.cam_states.end(); ++iter) {
+    CAMState& cam_state = iter->second;
+    const VectorXd& delta_x_cam = delta_x.segment<6>(
+        21+6*iter.slot());
     const Vector4d dq_cam = smallAngleQuaternion(delta_x_cam.head<3>());
-    cam_state_iter->second.orientation = quaternionMultiplication(
-        dq_cam, cam_state_iter->second.orientation);
-    cam_state_iter->second.position += delta_x_cam.tail<3>();
+    cam_state.orientation = quaternionMultiplication(
+        dq_cam, cam_state.orientation);
+    cam_state.position += delta_x_cam.tail<3>();
+    cam_state.updatePoseCache();
   }
 
   // Update state covariance.
-  MatrixXd I_KH = MatrixXd::Identity(K.rows(), H_thin.cols()) - K*H_thin;
+  // P = (I-KH)*P = P - M^T*M, as a symmetric rank-k update of
+  // the upper triangle.
   //state_server.state_cov = I_KH*state_server.state_cov*I_KH.transpose() +
   //  K*K.transpose()*Feature::observation_noise;       // QXC：有点小错误，应是K*Feature::observation_noise*K.transpose()
-  state_server.state_cov = I_KH*state_server.state_cov;     // QXC：参考秦永元《卡尔曼滤波与组合导航》第三版P34式(2.2.4e')
-
-  // Fix the covariance to be symmetric
-  MatrixXd state_cov_fixed = (state_server.state_cov +
-      state_server.state_cov.transpose()) / 2.0;
-  state_server.state_cov = state_cov_fixed;
+  state_server.state_cov.selfadjointView<Upper>().rankUpdate(
+      M.transpose(), -1.0);     // QXC：参考秦永元《卡尔曼滤波与组合导航》第三版P34式(2.2.4e')
 
   return;
 }
 
 // 没太看懂具体原理，但应该是用来检测基于H阵的测量预测协方差和残差r是否契合的方法
 bool MsckfVio::gatingTest(
-    const MatrixXd& H, const VectorXd& r, const int& dof) {
+    const FeatureJacobian& H, const int& dof) const {
+
+  // Only the covariance of the camera states observing the
+  // feature is needed, so the cost does not depend on the
+  // number of camera states in the window.
+  const int cam_num = H.cam_cols.size();
+  MatrixXd P_c(6*cam_num, 6*cam_num);
+  for (int i = 0; i < cam_num; ++i) {
+    for (int j = i; j < cam_num; ++j) {
+      const Matrix<double, 6, 6> P_ij = state_server.covBlock<6, 6>(
+          H.cam_cols[i], H.cam_cols[j]);
+      P_c.block<6, 6>(6*i, 6*j) = P_ij;
+      P_c.block<6, 6>(6*j, 6*i) = P_ij.transpose();
+    }
+  }
 
-  MatrixXd P1 = H * state_server.state_cov * H.transpose();
+  MatrixXd P1 = H.H_c * P_c * H.H_c.transpose();
   MatrixXd P2 = Feature::observation_noise *
     MatrixXd::Identity(H.rows(), H.rows());
+  const VectorXd& r = H.r;
   double gamma = r.transpose() * (P1+P2).ldlt().solve(r);   // QXC：相当于是在算 rT*[(P1+P2)^-1]*r
 
   //cout << dof << " " << gamma << " " <<
   //  chi_squared_test_table[dof] << " ";
 
-  if (gamma < chi_squared_test_table[dof]) {
+  // The table only covers the dofs up to 99, and a larger dof
+  // fails the test as before.
+  const auto table_iter = chi_squared_test_table.find(dof);
+  if (table_iter != chi_squared_test_table.end() &&
+      gamma < table_iter->second) {
     //cout << "passed" << endl;
     return true;
   } else {
@@ -1063,16 +1280,27 @@ bool MsckfVio::gatingTest(
   }
 }
 
-// 选出当前帧不再能跟踪到的feature，筛选掉质量不佳者，利用通过筛选的feature计算测量Jacobian，继而进行MSCKF测量更新，最后将这些不再被跟踪的feature删掉。
-// 注意，最后被删除的feature包括：失效feature以及进行了测量更新的feature，首先它们得满足不被当前帧观测到。
-// 还有一个细节是，所有通过筛选的feature，在计算完Jacobian之后都应当进行门限筛选（基于Jacobian和测量残差），进一步剔除一些质量不好的feature。
-void MsckfVio::removeLostFeatures() {
+void MsckfVio::covJacobianProduct(
+    const FeatureJacobian& H, MatrixXd& PHt) const {
 
-  // Remove the features that lost track.
-  // BTW, find the size the final Jacobian matrix and residual vector.
-  int jacobian_row_size = 0;
-  vector<FeatureIDType> invalid_feature_ids(0);
-  vector<FeatureIDType> processed_feature_ids(0);
+  // Only the columns of P of the camera states observing the
+  // feature are needed.
+  PHt = MatrixXd::Zero(state_server.state_cov.rows(), H.rows());
+  for (int i = 0; i < H.cam_cols.size(); ++i)
+    PHt.noalias() += state_server.covCols<6>(H.cam_cols[i]) *
+      H.H_c.middleCols<6>(6*i).transpose();
+  return;
+}
+
+void MsckfVio::findLostFeatures(
+    const std::function<bool(const Feature&)>& is_tracked,
+    const CamStateServer& cam_states,
+    vector<FeatureIDType>& invalid_feature_ids,
+    vector<FeatureIDType>& processed_feature_ids) {
+
+  invalid_feature_ids.clear();
+  processed_feature_ids.clear();
+  vector<FeatureIDType> uninitialized_feature_ids(0);
 
   for (auto iter = map_server.begin();    // QXC：根据Mour07中的III-E，筛选出的是不再能跟踪到的，且能够初始化成功的feature
       iter != map_server.end(); ++iter) {
@@ -1080,82 +1308,211 @@ void MsckfVio::removeLostFeatures() {
     auto& feature = iter->second;
 
     // Pass the features that are still being tracked.
-    if (feature.observations.find(state_server.imu_state.id) !=     // QXC：当某feature在当前状态中有观测时，跳过（continue）
-        feature.observations.end()) continue;
+    if (is_tracked(feature)) continue;     // QXC：当某feature在当前状态中有观测时，跳过（continue）
     if (feature.observations.size() < 3) {        // QXC：对于当前未观测到的feature，如果它在其他帧被观测到的总次数小于3（即只在两个采样时刻被观测到过），则认为它是失效的
       invalid_feature_ids.push_back(feature.id);
       continue;
     }
 
-    // Check if the feature can be initialized if it
-    // has not been.
-    if (!feature.is_initialized) {      // QXC：feature未被初始化时才会进行下列检查
-      if (!feature.checkMotion(state_server.cam_states)) {
-        invalid_feature_ids.push_back(feature.id);      // QXC：当feature在观测到其的首末两帧中反映的视差较小时，认为它是失效的
-        continue;
-      } else {
-        if(!feature.initializePosition(state_server.cam_states)) {      // QXC：尝试对feature的位置进行计算（利用Mour07中Appendix给出的方法）
-          invalid_feature_ids.push_back(feature.id);    // QXC：feature初始化失败时也认为它是失效的
-          continue;
-        }
-      }
-    }
+    // The features which have not been initialized are
+    // triangulated together below.
+    if (!feature.is_initialized)
+      uninitialized_feature_ids.push_back(feature.id);
+    processed_feature_ids.push_back(feature.id);
+  }
 
-    // QXC：来到这里说明这个feature是当前未观测到，但在其他时刻观测次数超过2次，且成功初始化的
+  // Check if the features can be initialized if they
+  // have not been.       // QXC：检查视差并尝试对feature的位置进行计算（利用Mour07中Appendix给出的方法），失败的feature被认为是失效的
+  vector<char> is_initialized(0);
+  initializeFeaturePositions(uninitialized_feature_ids,
+      cam_states, thread_pool.get(),
+      map_server, is_initialized);
 
-    jacobian_row_size += 4*feature.observations.size() - 3;     // QXC：双目所以乘以4，但为什么要减3呢？这里应该是计算进行了nullspace边缘化后的H尺寸，因此要减去3
-    processed_feature_ids.push_back(feature.id);
+  for (int i = 0; i < uninitialized_feature_ids.size(); ++i) {
+    if (!is_initialized[i])
+      invalid_feature_ids.push_back(uninitialized_feature_ids[i]);
+  }
+
+  // QXC：剩下的是当前未观测到，但在其他时刻观测次数超过2次，且成功初始化的feature
+  if (uninitialized_feature_ids.size() > 0) {
+    auto is_invalid = [this](const FeatureIDType& feature_id) {
+      return !map_server.find(feature_id)->second.is_initialized;
+    };
+    processed_feature_ids.erase(std::remove_if(
+          processed_feature_ids.begin(), processed_feature_ids.end(),
+          is_invalid), processed_feature_ids.end());
+  }
+
+  return;
+}
+
+void MsckfVio::lostFeatureJacobian(const CamStateServer& cam_states,
+    const FeatureIDType& feature_id, FeatureJacobian& H) const {
+  const auto& feature = map_server.find(feature_id)->second;
+
+  vector<StateIDType> cam_state_ids(0);
+  for (const auto& measurement : feature.observations)
+    cam_state_ids.push_back(measurement.first);
+
+  featureJacobian(cam_states, feature_id, cam_state_ids, H);    // QXC：求某个feature观测相关的Jacobian，进行null space marginalization
+  return;
+}
+
+void MsckfVio::startLostFeatureTask(
+    const CameraMeasurementConstPtr& msg) {
+
+  // The features in the msg are the ones still tracked.
+  vector<FeatureIDType> tracked_feature_ids(0);
+  tracked_feature_ids.reserve(msg->features.size());
+  for (const auto& feature : msg->features)
+    tracked_feature_ids.push_back(feature.id);
+  sort(tracked_feature_ids.begin(), tracked_feature_ids.end());
+
+  lost_feature_cam_states = state_server.cam_states;
+  lost_feature_task = std::async(std::launch::async,
+      &MsckfVio::prepareLostFeatures, this, tracked_feature_ids);
+  return;
+}
+
+void MsckfVio::prepareLostFeatures(
+    const vector<FeatureIDType>& tracked_feature_ids) {
+
+  // The observations of the msg are not added yet. The lost
+  // features, their triangulation and their Jacobians are the
+  // same as found after that, since they only depend on the
+  // camera states which already exist.
+  findLostFeatures([&tracked_feature_ids](const Feature& feature) {
+        return binary_search(tracked_feature_ids.begin(),
+            tracked_feature_ids.end(), feature.id);
+      }, lost_feature_cam_states,
+      lost_invalid_feature_ids, lost_feature_ids);
+
+  lost_feature_jacobians.resize(lost_feature_ids.size());
+  auto compute_jacobian = [&](int i) {
+    lostFeatureJacobian(lost_feature_cam_states,
+        lost_feature_ids[i], lost_feature_jacobians[i]);
+  };
+  if (thread_pool) {
+    thread_pool->parallelFor(lost_feature_ids.size(), compute_jacobian);
+  } else {
+    for (int i = 0; i < lost_feature_ids.size(); ++i)
+      compute_jacobian(i);
   }
 
-  //cout << "invalid/processed feature #: " <<
-  //  invalid_feature_ids.size() << "/" <<
-  //  processed_feature_ids.size() << endl;
-  //cout << "jacobian row #: " << jacobian_row_size << endl;
+  return;
+}
+
+// 选出当前帧不再能跟踪到的feature，筛选掉质量不佳者，利用通过筛选的feature计算测量Jacobian，继而进行MSCKF测量更新，最后将这些不再被跟踪的feature删掉。
+// 注意，最后被删除的feature包括：失效feature以及进行了测量更新的feature，首先它们得满足不被当前帧观测到。
+// 还有一个细节是，所有通过筛选的feature，在计算完Jacobian之后都应当进行门限筛选（基于Jacobian和测量残差），进一步剔除一些质量不好的feature。
+void MsckfVio::removeLostFeatures() {
+
+  // The measurements of this image are collected from here.
+  feature_measurements.reset(state_server.state_cov.cols());
+
+  // Remove the features that lost track. If pipelined, they
+  // have been found and their Jacobians computed by the joined
+  // lost_feature_task.
+  vector<FeatureIDType> invalid_feature_ids(0);
+  vector<FeatureIDType> processed_feature_ids(0);
+  vector<FeatureJacobian> prepared_H_xjs(0);
+  const bool is_prepared = pipeline_lost_features;
+  if (is_prepared) {
+    invalid_feature_ids.swap(lost_invalid_feature_ids);
+    processed_feature_ids.swap(lost_feature_ids);
+    prepared_H_xjs.swap(lost_feature_jacobians);
+  } else {
+    const StateIDType state_id = state_server.imu_state.id;
+    findLostFeatures([state_id](const Feature& feature) {
+          return feature.observations.find(state_id) !=
+            feature.observations.end();
+        }, state_server.cam_states,
+        invalid_feature_ids, processed_feature_ids);
+  }
 
   // Remove the features that do not have enough measurements.
-  for (const auto& feature_id : invalid_feature_ids)    // QXC：移除失效特征，包括只观测到2次的、视差过小的以及初始化位置失败的
-    map_server.erase(feature_id);
+  map_server.erase(invalid_feature_ids);    // QXC：移除失效特征，包括只观测到2次的、视差过小的以及初始化位置失败的
 
   // Return if there is no lost feature to be processed.
   if (processed_feature_ids.size() == 0) return;    // QXC：根据Mour07中III-E，要处理的是不再能跟踪到的feature
 
-  MatrixXd H_x = MatrixXd::Zero(jacobian_row_size,
-      21+6*state_server.cam_states.size());
-  VectorXd r = VectorXd::Zero(jacobian_row_size);
-  int stack_cntr = 0;
+  // Stack the Jacobian of each feature that passes the gating
+  // test, along with its P*H^T if the stack still keeps it.
+  // Once there are more rows than the state, the Jacobians are
+  // folded into a triangular factor as soon as they are
+  // computed instead, so that the memory used does not grow
+  // with the number of measurement rows.
+  MeasurementStack& measurements = feature_measurements;
 
   // Process the features which lose track.
-  for (const auto& feature_id : processed_feature_ids) {    // QXC：求取所有选出的feature对应的Jacobian，将它们堆叠起来
-    auto& feature = map_server[feature_id];
-
-    vector<StateIDType> cam_state_ids(0);
-    for (const auto& measurement : feature.observations)
-      cam_state_ids.push_back(measurement.first);
-
-    MatrixXd H_xj;
-    VectorXd r_j;
-    featureJacobian(feature.id, cam_state_ids, H_xj, r_j);    // QXC：求某个feature观测相关的Jacobian，进行null space marginalization
-
-    if (gatingTest(H_xj, r_j, cam_state_ids.size()-1)) {    // QXC：用门限测试检测基于H_xj的测量预测协方差和残差的关系是否合理
-      H_x.block(stack_cntr, 0, H_xj.rows(), H_xj.cols()) = H_xj;
-      r.segment(stack_cntr, r_j.rows()) = r_j;
-      stack_cntr += H_xj.rows();
+  if (!thread_pool) {
+    for (int i = 0; i < processed_feature_ids.size(); ++i) {    // QXC：求取所有选出的feature对应的Jacobian，逐个用Givens旋转合并到上三角阵中
+      const auto& feature =
+        map_server.find(processed_feature_ids[i])->second;
+
+      FeatureJacobian H_xj;
+      MatrixXd PHt_j;
+      if (is_prepared)
+        H_xj = std::move(prepared_H_xjs[i]);
+      else
+        lostFeatureJacobian(state_server.cam_states, feature.id, H_xj);
+
+      if (!gatingTest(H_xj, feature.observations.size()-1)) continue;      // QXC：用门限测试检测基于H_xj的测量预测协方差和残差的关系是否合理
+      if (measurements.keepsHP(H_xj.rows()))
+        covJacobianProduct(H_xj, PHt_j);
+      measurements.addRows(H_xj, PHt_j);
     }
+  } else {
+    // The Jacobians and the gating tests of a chunk of features
+    // are computed in parallel, then the P*H^T of the passed
+    // ones to be kept, and the passed ones are stacked in the
+    // order of processed_feature_ids. This gives the same result
+    // as the serial loop above, bit by bit.
+    const int chunk_size = 8 * thread_pool->size();
+    vector<FeatureJacobian> H_xjs(chunk_size);
+    vector<MatrixXd> PHt_js(chunk_size);
+    vector<char> is_gated(chunk_size);
+    vector<int> kept_ids(0);
+
+    for (int chunk_begin = 0; chunk_begin < processed_feature_ids.size();
+        chunk_begin += chunk_size) {
+      const int chunk_end = std::min<int>(chunk_begin+chunk_size,
+          processed_feature_ids.size());
+
+      thread_pool->parallelFor(chunk_end-chunk_begin,
+          [&](int i) {
+        const auto& feature = map_server.find(
+            processed_feature_ids[chunk_begin+i])->second;
+
+        if (is_prepared)
+          H_xjs[i] = std::move(prepared_H_xjs[chunk_begin+i]);
+        else
+          lostFeatureJacobian(state_server.cam_states, feature.id, H_xjs[i]);
+        is_gated[i] = gatingTest(H_xjs[i], feature.observations.size()-1);
+      });
+
+      kept_ids.clear();
+      for (int i = 0, rows = 0; i < chunk_end-chunk_begin; ++i) {
+        if (!is_gated[i]) continue;
+        rows += H_xjs[i].rows();
+        if (measurements.keepsHP(rows)) kept_ids.push_back(i);
+      }
+      thread_pool->parallelFor(kept_ids.size(), [&](int i) {
+        covJacobianProduct(H_xjs[kept_ids[i]], PHt_js[kept_ids[i]]);
+      });
 
-    // Put an upper bound on the row size of measurement Jacobian,
-    // which helps guarantee the executation time.
-    if (stack_cntr > 1500) break;
+      for (int i = 0; i < chunk_end-chunk_begin; ++i)
+        if (is_gated[i]) measurements.addRows(H_xjs[i], PHt_js[i]);
+    }
   }
 
-  H_x.conservativeResize(stack_cntr, H_x.cols());   // QXC：重新定义矩阵维数，因为有的feature没通过gatingtest
-  r.conservativeResize(stack_cntr);                 //      或者有的feature在featureJacobian中二次确认观测cam可能会减少cam数量
-
-  // Perform the measurement update step.
-  measurementUpdate(H_x, r);        // QXC：根据Mour07中III-E部分进行MSCKF的测量更新
+  // Perform the measurement update step, unless it is merged
+  // with the one in pruneCamStateBuffer().
+  if (!merge_feature_updates)
+    measurementUpdate(measurements);        // QXC：根据Mour07中III-E部分进行MSCKF的测量更新
 
   // Remove all processed features from the map.
-  for (const auto& feature_id : processed_feature_ids)      // QXC：这些测量不再被观测到，将它们移除
-    map_server.erase(feature_id);
+  map_server.erase(processed_feature_ids);      // QXC：这些测量不再被观测到，将它们移除
 
   return;
 }
@@ -1211,17 +1568,42 @@ void MsckfVio::findRedundantCamStates(
 // 注意，所有feature关于要被剔除的帧的观测都将被删除，相当于完全消除要被剔除帧的残余影响。
 void MsckfVio::pruneCamStateBuffer() {
 
-  if (state_server.cam_states.size() < max_cam_state_size)      // QXC：当扩维的cam状态超过最大数量时才继续
+  if (state_server.cam_states.size() < max_cam_state_size) {      // QXC：当扩维的cam状态超过最大数量时才继续
+    // Nothing to add to the measurements of the lost
+    // features, which are still to be used if merged.
+    if (merge_feature_updates)
+      measurementUpdate(feature_measurements);
     return;
+  }
 
   // Find two camera states to be removed.
   vector<StateIDType> rm_cam_state_ids(0);
   findRedundantCamStates(rm_cam_state_ids);     // QXC：挑选出冗余的cam状态（两条）
 
-  // Find the size of the Jacobian matrix.
-  int jacobian_row_size = 0;
-  for (auto& item : map_server) {
-    auto& feature = item.second;
+  // Find the features observing the camera states to be
+  // removed from the inverted index, in the order of their ids.
+  // The ones erased from map_server since are skipped.
+  vector<FeatureIDType> involved_feature_ids(0);
+  for (const auto& cam_id : rm_cam_state_ids) {
+    const auto& feature_ids =
+      cam_slot_feature_ids[state_server.cam_states.slot(cam_id)];
+    involved_feature_ids.insert(involved_feature_ids.end(),
+        feature_ids.begin(), feature_ids.end());
+  }
+  sort(involved_feature_ids.begin(), involved_feature_ids.end());
+  involved_feature_ids.erase(std::unique(involved_feature_ids.begin(),
+        involved_feature_ids.end()), involved_feature_ids.end());
+  involved_feature_ids.erase(std::remove_if(
+        involved_feature_ids.begin(), involved_feature_ids.end(),
+        [this](const FeatureIDType& feature_id) {
+          return map_server.count(feature_id) == 0; }),
+      involved_feature_ids.end());
+
+  // Remove the observations of the features which can not
+  // be used in the update.
+  vector<FeatureIDType> uninitialized_feature_ids(0);
+  for (const auto& feature_id : involved_feature_ids) {
+    auto& feature = map_server.find(feature_id)->second;
     // Check how many camera states to be removed are associated
     // with this feature.
     vector<StateIDType> involved_cam_state_ids(0);
@@ -1237,39 +1619,37 @@ void MsckfVio::pruneCamStateBuffer() {
       continue;
     }
 
-    if (!feature.is_initialized) {      // QXC：feature未被初始化时才会进行下列检查
-      // Check if the feature can be initialize.
-      if (!feature.checkMotion(state_server.cam_states)) {
-        // If the feature cannot be initialized, just remove
-        // the observations associated with the camera states
-        // to be removed.       // QXC：当feature在观测到其的首末两帧中反映的视差较小时，删除其关于要剔除的cam的观测
-        for (const auto& cam_id : involved_cam_state_ids)
-          feature.observations.erase(cam_id);
-        continue;
-      } else {
-        if(!feature.initializePosition(state_server.cam_states)) {      // QXC：初始化失败时，删除其关于要剔除的cam的观测
-          for (const auto& cam_id : involved_cam_state_ids)
-            feature.observations.erase(cam_id);
-          continue;
-        }
-      }
-    }
-
-    // QXC：代码来到这里说明某个feature能被要剔除的1个以上的can观测到，且该feature位置成功初始化（过）。
+    if (!feature.is_initialized)
+      uninitialized_feature_ids.push_back(feature.id);
+  }
 
-    jacobian_row_size += 4*involved_cam_state_ids.size() - 3;
+  // Check if the features can be initialized. If not, just
+  // remove the observations associated with the camera states
+  // to be removed.       // QXC：视差过小或初始化失败时，删除其关于要剔除的cam的观测
+  vector<char> is_initialized(0);
+  initializeFeaturePositions(uninitialized_feature_ids,
+      state_server.cam_states, thread_pool.get(),
+      map_server, is_initialized);
+
+  for (int i = 0; i < uninitialized_feature_ids.size(); ++i) {
+    if (is_initialized[i]) continue;
+    auto& feature = map_server.find(uninitialized_feature_ids[i])->second;
+    for (const auto& cam_id : rm_cam_state_ids)
+      feature.observations.erase(cam_id);
   }
 
-  //cout << "jacobian row #: " << jacobian_row_size << endl;
+  // QXC：代码来到这里说明某个feature要么不被要剔除的cam观测到，要么能被要剔除的1个以上的cam观测到，且该feature位置成功初始化（过）。
 
-  // Compute the Jacobian and residual.
-  MatrixXd H_x = MatrixXd::Zero(jacobian_row_size,
-      21+6*state_server.cam_states.size());
-  VectorXd r = VectorXd::Zero(jacobian_row_size);
-  int stack_cntr = 0;
+  // Compute the Jacobian and residual, and stack them feature
+  // by feature, after the ones of the lost features if the
+  // updates are merged. The Jacobians are all computed at the
+  // state before the update then.
+  MeasurementStack& measurements = feature_measurements;
+  if (!merge_feature_updates)
+    measurements.reset(state_server.state_cov.cols());
 
-  for (auto& item : map_server) {
-    auto& feature = item.second;
+  for (const auto& feature_id : involved_feature_ids) {
+    auto& feature = map_server.find(feature_id)->second;
     // Check how many camera states to be removed are associated
     // with this feature.
     vector<StateIDType> involved_cam_state_ids(0);
@@ -1283,57 +1663,38 @@ void MsckfVio::pruneCamStateBuffer() {
 
     if (involved_cam_state_ids.size() == 0) continue;
 
-    MatrixXd H_xj;
-    VectorXd r_j;
-    featureJacobian(feature.id, involved_cam_state_ids, H_xj, r_j);   // QXC：求某个feature观测相关的Jacobian
+    FeatureJacobian H_xj;
+    MatrixXd PHt_j;
+    featureJacobian(state_server.cam_states, feature.id,
+        involved_cam_state_ids, H_xj);   // QXC：求某个feature观测相关的Jacobian
 
-    if (gatingTest(H_xj, r_j, involved_cam_state_ids.size())) {     // QXC：用门限测试检测基于H_xj的测量预测协方差和残差的关系是否合理
-      H_x.block(stack_cntr, 0, H_xj.rows(), H_xj.cols()) = H_xj;
-      r.segment(stack_cntr, r_j.rows()) = r_j;
-      stack_cntr += H_xj.rows();
+    if (gatingTest(H_xj, involved_cam_state_ids.size())) {     // QXC：用门限测试检测基于H_xj的测量预测协方差和残差的关系是否合理
+      if (measurements.keepsHP(H_xj.rows()))
+        covJacobianProduct(H_xj, PHt_j);
+      measurements.addRows(H_xj, PHt_j);
     }
 
     for (const auto& cam_id : involved_cam_state_ids)   // QXC：处理过后将feature中关于要剔除的cam的观测剔除
       feature.observations.erase(cam_id);
   }
 
-  H_x.conservativeResize(stack_cntr, H_x.cols());   // QXC：重新定义矩阵维数，因为有的feature没通过gatingtest，
-  r.conservativeResize(stack_cntr);                 //      或者有的feature在featureJacobian中二次确认观测cam可能会减少cam数量
-
   // Perform measurement update.
-  measurementUpdate(H_x, r);        // QXC：进行MSCKF的测量更新，参照Mour07的III-E
+  measurementUpdate(measurements);        // QXC：进行MSCKF的测量更新，参照Mour07的III-E
 
   for (const auto& cam_id : rm_cam_state_ids) {
-    int cam_sequence = std::distance(state_server.cam_states.begin(),
-        state_server.cam_states.find(cam_id));
-    int cam_state_start = 21 + 6*cam_sequence;
-    int cam_state_end = cam_state_start + 6;
-
-    // Remove the corresponding rows and columns in the state
-    // covariance matrix.
-    if (cam_state_end < state_server.state_cov.rows()) {
-      state_server.state_cov.block(cam_state_start, 0,
-          state_server.state_cov.rows()-cam_state_end,
-          state_server.state_cov.cols()) =
-        state_server.state_cov.block(cam_state_end, 0,
-            state_server.state_cov.rows()-cam_state_end,
-            state_server.state_cov.cols());
-
-      state_server.state_cov.block(0, cam_state_start,
-          state_server.state_cov.rows(),
-          state_server.state_cov.cols()-cam_state_end) =
-        state_server.state_cov.block(0, cam_state_end,
-            state_server.state_cov.rows(),
-            state_server.state_cov.cols()-cam_state_end);
-
-      state_server.state_cov.conservativeResize(
-          state_server.state_cov.rows()-6, state_server.state_cov.cols()-6);
-    } else {    // QXC：暂时没想明白为什么会出现else的情形（即要删除的cam状态的维度已经超出了协方差维度）
-      state_server.state_cov.conservativeResize(
-          state_server.state_cov.rows()-6, state_server.state_cov.cols()-6);
-    }
-
-    // Remove this camera state in the state vector.
+    const int cam_index = 21 + 6*state_server.cam_states.slot(cam_id);
+
+    // Clear the corresponding rows and columns in the state
+    // covariance matrix. The slot is freed along with the
+    // camera state below.
+    state_server.state_cov.block(cam_index, 0,
+        6, state_server.state_cov.cols()).setZero();
+    state_server.state_cov.block(0, cam_index,
+        state_server.state_cov.rows(), 6).setZero();
+
+    // Remove this camera state in the state vector, and its
+    // features in the inverted index.
+    cam_slot_feature_ids[state_server.cam_states.slot(cam_id)].clear();
     state_server.cam_states.erase(cam_id);
   }
 
@@ -1363,8 +1724,17 @@ void MsckfVio::onlineReset() {
   ROS_INFO("Stardard deviation in xyz: %f, %f, %f",
       position_x_std, position_y_std, position_z_std);
 
+  resetCamStatesAndCovariance();
+
+  ROS_WARN("%lld online reset complete...", online_reset_counter);
+  return;
+}
+
+// 删除所有相机状态和特征点，并重置状态协方差，IMU状态保持不变
+void MsckfVio::resetCamStatesAndCovariance() {
   // Remove all existing camera states.
   state_server.cam_states.clear();
+  for (auto& feature_ids : cam_slot_feature_ids) feature_ids.clear();
 
   // Clear all exsiting features in the map.
   map_server.clear();
@@ -1384,7 +1754,7 @@ void MsckfVio::onlineReset() {
   nh.param<double>("initial_covariance/extrinsic_translation_cov",
       extrinsic_translation_cov, 1e-4);
 
-  state_server.state_cov = MatrixXd::Zero(21, 21);
+  state_server.state_cov.setZero();
   for (int i = 3; i < 6; ++i)
     state_server.state_cov(i, i) = gyro_bias_cov;
   for (int i = 6; i < 9; ++i)
@@ -1396,24 +1766,74 @@ void MsckfVio::onlineReset() {
   for (int i = 18; i < 21; ++i)
     state_server.state_cov(i, i) = extrinsic_translation_cov;
 
-  ROS_WARN("%lld online reset complete...", online_reset_counter);
+  state_server.imu_transition.setIdentity();
   return;
 }
 
-// 发布tf、odometry、特征点云等消息
-void MsckfVio::publish(const ros::Time& time) {
+void MsckfVio::propagateImuRateState(const ImuSample& sample) {
+  IMUState& imu_state = imu_rate_state;
+  const double dtime = sample.time - imu_state.time;
+  if (dtime <= 0.0) return;
 
-  // Convert the IMU frame to the body frame.
-  const IMUState& imu_state = state_server.imu_state;
+  // Only the state is propagated, with the biases of the
+  // latest update.
+  predictNewState(dtime, sample.gyro-imu_state.gyro_bias,
+      sample.acc-imu_state.acc_bias, imu_state);
+  imu_state.time = sample.time;
+  return;
+}
+
+void MsckfVio::resetImuRateState() {
+  std::lock_guard<std::mutex> imu_rate_lock(imu_rate_state_mutex);
+  imu_rate_state = state_server.imu_state;
+  imu_rate_state_valid = true;
+
+  // Catch up with the IMU msgs received after the image, which
+  // are still in the buffer.
+  for (size_t i = imu_buffer.upperBound(imu_rate_state.time);
+      i < imu_buffer.size(); ++i)
+    propagateImuRateState(imu_buffer[i]);
+  return;
+}
+
+void MsckfVio::bodyPose(const IMUState& imu_state,
+    Eigen::Isometry3d& T_b_w, Eigen::Vector3d& body_velocity) const {
   Eigen::Isometry3d T_i_w = Eigen::Isometry3d::Identity();
   T_i_w.linear() = quaternionToRotation(
       imu_state.orientation).transpose();
   T_i_w.translation() = imu_state.position;
 
-  Eigen::Isometry3d T_b_w = IMUState::T_imu_body * T_i_w *
+  T_b_w = IMUState::T_imu_body * T_i_w *
     IMUState::T_imu_body.inverse();     // QXC：没看懂为什么还要乘个T_imu_body的逆
-  Eigen::Vector3d body_velocity =
-    IMUState::T_imu_body.linear() * imu_state.velocity;
+  body_velocity = IMUState::T_imu_body.linear() * imu_state.velocity;
+  return;
+}
+
+void MsckfVio::publishImuRateOdom(const IMUState& imu_state,
+    const ros::Time& time) {
+  Eigen::Isometry3d T_b_w;
+  Eigen::Vector3d body_velocity;
+  bodyPose(imu_state, T_b_w, body_velocity);
+
+  // The covariance is not propagated, and is left zero.
+  nav_msgs::Odometry odom_msg;
+  odom_msg.header.stamp = time;
+  odom_msg.header.frame_id = fixed_frame_id;
+  odom_msg.child_frame_id = child_frame_id;
+  tf::poseEigenToMsg(T_b_w, odom_msg.pose.pose);
+  tf::vectorEigenToMsg(body_velocity, odom_msg.twist.twist.linear);
+
+  imu_rate_odom_pub.publish(odom_msg);
+  return;
+}
+
+// 发布tf、odometry、特征点云等消息
+void MsckfVio::publish(const ros::Time& time) {
+
+  // Convert the IMU frame to the body frame.
+  Eigen::Isometry3d T_b_w;
+  Eigen::Vector3d body_velocity;
+  bodyPose(state_server.imu_state, T_b_w, body_velocity);
 
   // Publish tf     // QXC：tf是用于维护一个机器人上所有坐标系间相对变换关系的东西
   if (publish_tf) {
@@ -1433,10 +1853,10 @@ void MsckfVio::publish(const ros::Time& time) {
   tf::vectorEigenToMsg(body_velocity, odom_msg.twist.twist.linear);
 
   // Convert the covariance.
-  Matrix3d P_oo = state_server.state_cov.block<3, 3>(0, 0);
-  Matrix3d P_op = state_server.state_cov.block<3, 3>(0, 12);
-  Matrix3d P_po = state_server.state_cov.block<3, 3>(12, 0);
-  Matrix3d P_pp = state_server.state_cov.block<3, 3>(12, 12);
+  Matrix3d P_oo = state_server.covBlock<3, 3>(0, 0);
+  Matrix3d P_op = state_server.covBlock<3, 3>(0, 12);
+  Matrix3d P_po = state_server.covBlock<3, 3>(12, 0);
+  Matrix3d P_pp = state_server.covBlock<3, 3>(12, 12);
   Matrix<double, 6, 6> P_imu_pose = Matrix<double, 6, 6>::Zero();
   P_imu_pose << P_pp, P_po, P_op, P_oo;
 
@@ -1451,7 +1871,7 @@ void MsckfVio::publish(const ros::Time& time) {
       odom_msg.pose.covariance[6*i+j] = P_body_pose(i, j);
 
   // Construct the covariance for the velocity.
-  Matrix3d P_imu_vel = state_server.state_cov.block<3, 3>(6, 6);
+  Matrix3d P_imu_vel = state_server.covBlock<3, 3>(6, 6);
   Matrix3d H_vel = IMUState::T_imu_body.linear();
   Matrix3d P_body_vel = H_vel * P_imu_vel * H_vel.transpose();
   for (int i = 0; i < 3; ++i)
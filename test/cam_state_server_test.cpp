@@ -0,0 +1,141 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <map>
+#include <set>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <msckf_vio/cam_state.h>
+
+using namespace std;
+using namespace msckf_vio;
+
+namespace {
+
+// Check the camera states against the reference map of the ids
+// to their times and slots.
+void checkStates(const CamStateServer& cam_states,
+    const map<StateIDType, pair<double, int> >& reference) {
+  ASSERT_EQ(cam_states.size(), reference.size());
+
+  auto ref_iter = reference.begin();
+  set<int> slots;
+  for (auto iter = cam_states.begin();
+      iter != cam_states.end(); ++iter, ++ref_iter) {
+    EXPECT_EQ(iter->first, ref_iter->first);
+    EXPECT_EQ(iter->second.time, ref_iter->second.first);
+    EXPECT_EQ(iter.slot(), ref_iter->second.second);
+    EXPECT_EQ(cam_states.slot(iter->first), iter.slot());
+    EXPECT_TRUE(cam_states.find(iter->first) == iter);
+    EXPECT_LT(iter.slot(), cam_states.slotNum());
+    slots.insert(iter.slot());
+  }
+  EXPECT_EQ(slots.size(), reference.size());
+
+  // Backwards as well.
+  auto iter = cam_states.end();
+  for (auto ref_riter = reference.rbegin();
+      ref_riter != reference.rend(); ++ref_riter)
+    EXPECT_EQ((--iter)->first, ref_riter->first);
+  return;
+}
+
+} // end namespace
+
+TEST(CamStateServerTest, slidingWindow) {
+  const int slot_num = 20;
+  CamStateServer cam_states(slot_num);
+  map<StateIDType, pair<double, int> > reference;
+
+  // Add a state per frame, and remove two of them once the
+  // window is full, either the oldest ones or ones close to the
+  // latest as in pruning the camera states.
+  srand(0);
+  for (StateIDType id = 0; id < 500; ++id) {
+    CAMState& cam_state = cam_states[id];
+    cam_state.time = 0.1 * id;
+    reference[id] = make_pair(cam_state.time, cam_states.slot(id));
+    EXPECT_EQ(cam_state.id, id);
+    checkStates(cam_states, reference);
+
+    if (cam_states.size() < slot_num) continue;
+    for (int i = 0; i < 2; ++i) {
+      auto iter = rand()%2 ? cam_states.begin() : --cam_states.end();
+      if (iter != cam_states.begin())
+        for (int j = 0; j < 2+i; ++j) --iter;
+      const StateIDType rm_id = iter->first;
+      EXPECT_EQ(cam_states.erase(rm_id), 1);
+      EXPECT_EQ(cam_states.erase(rm_id), 0);
+      reference.erase(rm_id);
+      EXPECT_TRUE(cam_states.find(rm_id) == cam_states.end());
+      EXPECT_EQ(cam_states.slot(rm_id), -1);
+    }
+    checkStates(cam_states, reference);
+  }
+
+  // The slots are never more than the states.
+  EXPECT_EQ(cam_states.slotNum(), slot_num);
+
+  cam_states.clear();
+  EXPECT_TRUE(cam_states.empty());
+  EXPECT_EQ(cam_states[1000].id, 1000);
+  EXPECT_EQ(cam_states.slot(1000), 0);
+  return;
+}
+
+TEST(CamStateServerTest, longLivedState) {
+  // The oldest state stays while the ids of the others grow far
+  // past the size of the id table, as when the platform is
+  // stationary, and the ids collide in the table all the time.
+  const int slot_num = 20;
+  CamStateServer cam_states(slot_num);
+  map<StateIDType, pair<double, int> > reference;
+
+  srand(1);
+  for (StateIDType id = 0; id < 5000; ++id) {
+    cam_states[id].time = 0.1 * id;
+    reference[id] = make_pair(cam_states[id].time, cam_states.slot(id));
+
+    if (cam_states.size() < slot_num) continue;
+    for (int i = 0; i < 2; ++i) {
+      // Any state but the oldest one.
+      auto iter = cam_states.begin();
+      const int pos = 1 + rand()%(cam_states.size()-1);
+      for (int j = 0; j < pos; ++j) ++iter;
+      const StateIDType rm_id = iter->first;
+      EXPECT_EQ(cam_states.erase(rm_id), 1);
+      reference.erase(rm_id);
+      EXPECT_EQ(cam_states.slot(rm_id), -1);
+    }
+    checkStates(cam_states, reference);
+  }
+
+  EXPECT_EQ(cam_states.begin()->first, 0);
+  EXPECT_EQ(cam_states.slotNum(), slot_num);
+  return;
+}
+
+TEST(CamStateServerTest, addSlots) {
+  // Without slots given, they are added as needed, and the
+  // ids do not have to come in order.
+  CamStateServer cam_states;
+  map<StateIDType, pair<double, int> > reference;
+  for (int i = 0; i < 100; ++i) {
+    const StateIDType id = (37*i) % 101 + 1000*(i%3);
+    cam_states[id].time = i;
+    reference[id] = make_pair(static_cast<double>(i), -1);
+  }
+  for (auto& item : reference)
+    item.second.second = cam_states.slot(item.first);
+  checkStates(cam_states, reference);
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -117,6 +117,67 @@ TEST(FeatureInitializeTest, sphereDistribution) {
   EXPECT_NEAR(error.norm(), 0, 0.05);
 }
 
+TEST(FeatureInitializeTest, batchInitialization) {
+  // Camera poses on a line along the x axis, looking at the
+  // positive z direction.
+  CamStateServer cam_states;
+  for (int i = 0; i < 5; ++i) {
+    CAMState new_cam_state;
+    new_cam_state.id = i;
+    new_cam_state.time = static_cast<double>(i);
+    new_cam_state.orientation = Vector4d(0.0, 0.0, 0.0, 1.0);
+    new_cam_state.position = Vector3d(0.2*i, 0.0, 0.0);
+    cam_states[new_cam_state.id] = new_cam_state;
+  }
+
+  // Features in front of the cameras. Every 5th feature is
+  // only observed by the first two camera states, which do not
+  // provide enough motion for the triangulation.
+  random_numbers::RandomNumberGenerator noise_generator;
+  MapServer map_server;
+  vector<FeatureIDType> feature_ids;
+  for (int j = 0; j < 50; ++j) {
+    Vector3d p(noise_generator.uniformReal(-2.0, 2.0),
+        noise_generator.uniformReal(-2.0, 2.0),
+        noise_generator.uniformReal(3.0, 6.0));
+
+    Feature feature(j);
+    for (int i = 0; i < (j%5 == 0 ? 2 : 5); ++i) {
+      Vector3d p_c = p - cam_states[i].position;
+      double u = p_c(0)/p_c(2) + noise_generator.gaussian(0.0, 0.001);
+      double v = p_c(1)/p_c(2) + noise_generator.gaussian(0.0, 0.001);
+      feature.observations[i] = Vector4d(u, v, u, v);
+    }
+    map_server[j] = feature;
+    feature_ids.push_back(j);
+  }
+
+  // Initialize the features one by one for reference.
+  MapServer map_server_serial = map_server;
+  for (auto& item : map_server_serial) {
+    Feature& feature = item.second;
+    if (feature.checkMotion(cam_states))
+      feature.initializePosition(cam_states);
+  }
+
+  ThreadPool thread_pool(4);
+  vector<char> is_valid;
+  initializeFeaturePositions(feature_ids, cam_states,
+      &thread_pool, map_server, is_valid);
+
+  ASSERT_EQ(is_valid.size(), feature_ids.size());
+  for (size_t j = 0; j < feature_ids.size(); ++j) {
+    const Feature& feature = map_server[feature_ids[j]];
+    const Feature& feature_serial = map_server_serial[feature_ids[j]];
+    EXPECT_EQ(static_cast<bool>(is_valid[j]), j%5 != 0);
+    EXPECT_EQ(feature.is_initialized, feature_serial.is_initialized);
+    if (is_valid[j]) {
+      EXPECT_EQ(feature.position, feature_serial.position);
+    }
+  }
+  return;
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,314 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <Eigen/Dense>
+#include <gtest/gtest.h>
+#include <msckf_vio/givens_utils.hpp>
+#include <msckf_vio/measurement_stack.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+// Stacked Jacobians of a feature observed by track_length
+// stereo camera states.
+void featureJacobians(const int& track_length,
+    MatrixXd& H_f, MatrixXd& H_x, VectorXd& r) {
+  H_f = MatrixXd::Random(4*track_length, 3);
+  H_x = MatrixXd::Zero(4*track_length, 6*track_length);
+  for (int i = 0; i < track_length; ++i)
+    H_x.block<4, 6>(4*i, 6*i) = Matrix<double, 4, 6>::Random();
+  r = VectorXd::Random(4*track_length);
+  return;
+}
+
+// Reference projection with the full U of the SVD.
+void svdProjection(const MatrixXd& H_f, const MatrixXd& H_x,
+    const VectorXd& r, MatrixXd& H_o, VectorXd& r_o) {
+  JacobiSVD<MatrixXd> svd_helper(H_f, ComputeFullU | ComputeThinV);
+  MatrixXd A = svd_helper.matrixU().rightCols(H_f.rows()-3);
+  H_o = A.transpose() * H_x;
+  r_o = A.transpose() * r;
+  return;
+}
+
+// Stacked Jacobians of feature_num features, each observed by a
+// few consecutive ones of cam_num camera states, after the
+// nullspace projection. The IMU columns are zero.
+void stackedJacobians(const int& feature_num, const int& cam_num,
+    MatrixXd& H, VectorXd& r) {
+  vector<MatrixXd> H_js;
+  for (int i = 0; i < feature_num; ++i) {
+    const int track_length = 2 + i%8;
+    const int first_cam = (7*i) % (cam_num-track_length+1);
+    MatrixXd H_f, H_x;
+    VectorXd r_j;
+    featureJacobians(track_length, H_f, H_x, r_j);
+    nullspaceProjection(H_f, H_x, r_j);
+
+    MatrixXd H_j = MatrixXd::Zero(H_x.rows()-3, 21+6*cam_num);
+    H_j.middleCols(21+6*first_cam, H_x.cols()) =
+      H_x.bottomRows(H_x.rows()-3);
+    H_js.push_back(H_j);
+  }
+
+  int rows = 0;
+  for (const auto& H_j : H_js) rows += H_j.rows();
+  H = MatrixXd::Zero(rows, 21+6*cam_num);
+  r = VectorXd::Random(rows);
+  for (int i = 0, row = 0; i < static_cast<int>(H_js.size()); ++i) {
+    H.middleRows(row, H_js[i].rows()) = H_js[i];
+    row += H_js[i].rows();
+  }
+  return;
+}
+
+} // end namespace
+
+TEST(GivensUtilsTest, nullspaceProjection) {
+  for (int track_length = 2; track_length <= 30; ++track_length) {
+    MatrixXd H_f, H_x;
+    VectorXd r;
+    featureJacobians(track_length, H_f, H_x, r);
+
+    MatrixXd H_svd;
+    VectorXd r_svd;
+    svdProjection(H_f, H_x, r, H_svd, r_svd);
+
+    // Project [H_f | H_x | r] to also check that the
+    // remaining rows are orthogonal to H_f.
+    const int rows = H_f.rows();
+    MatrixXd H_fx(rows, 3+H_x.cols());
+    H_fx << H_f, H_x;
+    VectorXd r_givens = r;
+    MatrixXd H_f_givens = H_f;
+    nullspaceProjection(H_f_givens, H_fx, r_givens);
+
+    const MatrixXd H_givens = H_fx.bottomRightCorner(rows-3, H_x.cols());
+    const VectorXd r_proj = r_givens.tail(rows-3);
+
+    EXPECT_NEAR(H_fx.bottomLeftCorner(rows-3, 3).cwiseAbs().maxCoeff(),
+        0.0, 1e-12);
+    EXPECT_NEAR(H_f_givens.bottomRows(rows-3).cwiseAbs().maxCoeff(),
+        0.0, 1e-12);
+
+    // Both projections span the same space, so the information
+    // they carry is the same.
+    EXPECT_NEAR((H_givens.transpose()*H_givens -
+          H_svd.transpose()*H_svd).cwiseAbs().maxCoeff(), 0.0, 1e-10);
+    EXPECT_NEAR((H_givens.transpose()*r_proj -
+          H_svd.transpose()*r_svd).cwiseAbs().maxCoeff(), 0.0, 1e-10);
+    EXPECT_NEAR(r_proj.squaredNorm(), r_svd.squaredNorm(), 1e-10);
+  }
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(GivensUtilsTest, DISABLED_nullspaceProjectionBenchmark) {
+  const int track_lengths[] = {3, 5, 10, 20, 30};
+  for (const int& track_length : track_lengths) {
+    const int feature_num = 2000 / track_length;
+    vector<MatrixXd> H_fs(feature_num), H_xs(feature_num);
+    vector<VectorXd> rs(feature_num);
+    for (int i = 0; i < feature_num; ++i)
+      featureJacobians(track_length, H_fs[i], H_xs[i], rs[i]);
+
+    double svd_sum = 0.0, givens_sum = 0.0;
+
+    auto start_time = chrono::steady_clock::now();
+    for (int i = 0; i < feature_num; ++i) {
+      MatrixXd H_o;
+      VectorXd r_o;
+      svdProjection(H_fs[i], H_xs[i], rs[i], H_o, r_o);
+      svd_sum += r_o.squaredNorm();
+    }
+    double svd_time = chrono::duration<double>(
+        chrono::steady_clock::now()-start_time).count();
+
+    start_time = chrono::steady_clock::now();
+    for (int i = 0; i < feature_num; ++i) {
+      MatrixXd H_f = H_fs[i];
+      MatrixXd H_x = H_xs[i];
+      VectorXd r = rs[i];
+      nullspaceProjection(H_f, H_x, r);
+      givens_sum += r.tail(r.rows()-3).squaredNorm();
+    }
+    double givens_time = chrono::duration<double>(
+        chrono::steady_clock::now()-start_time).count();
+
+    cout << "track length " << track_length << ": svd "
+      << svd_time/feature_num*1e6 << " us, givens "
+      << givens_time/feature_num*1e6 << " us, speedup "
+      << svd_time/givens_time << endl;
+
+    EXPECT_NEAR(svd_sum, givens_sum, 1e-8*svd_sum);
+  }
+  return;
+}
+
+TEST(GivensUtilsTest, givensQrCompression) {
+  MatrixXd H;
+  VectorXd r;
+  stackedJacobians(60, 20, H, r);
+
+  MatrixXd H_thin;
+  VectorXd r_thin;
+  givensQrCompression(H, r, H_thin, r_thin);
+
+  // The IMU columns are zero, so at most the camera columns
+  // are left as rows.
+  EXPECT_LE(H_thin.rows(), H.cols()-21);
+  EXPECT_NEAR((H_thin.transpose()*H_thin -
+        H.transpose()*H).cwiseAbs().maxCoeff(), 0.0, 1e-10);
+  EXPECT_NEAR((H_thin.transpose()*r_thin -
+        H.transpose()*r).cwiseAbs().maxCoeff(), 0.0, 1e-10);
+
+  // H_thin is upper triangular up to the dropped zero rows.
+  for (int i = 0; i < H_thin.rows(); ++i) {
+    int first_col = 0;
+    while (H_thin(i, first_col) == 0.0) ++first_col;
+    EXPECT_GE(first_col, i);
+    if (i > 0) {
+      int prev_first_col = 0;
+      while (H_thin(i-1, prev_first_col) == 0.0) ++prev_first_col;
+      EXPECT_GT(first_col, prev_first_col);
+    }
+  }
+  return;
+}
+
+TEST(GivensUtilsTest, givensQrAccumulator) {
+  MatrixXd H;
+  VectorXd r;
+  stackedJacobians(60, 20, H, r);
+
+  MatrixXd H_thin;
+  VectorXd r_thin;
+  givensQrCompression(H, r, H_thin, r_thin);
+
+  // Fold the rows in in chunks of different sizes.
+  GivensQrAccumulator accumulator(H.cols());
+  for (int row = 0, chunk = 1; row < H.rows(); row += chunk, ++chunk) {
+    chunk = min(chunk, static_cast<int>(H.rows())-row);
+    accumulator.addRows(H.middleRows(row, chunk), r.segment(row, chunk));
+  }
+  EXPECT_EQ(accumulator.rank(), H_thin.rows());
+
+  MatrixXd H_acc;
+  VectorXd r_acc;
+  accumulator.compress(H_acc, r_acc);
+  EXPECT_NEAR((H_acc-H_thin).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+  EXPECT_NEAR((r_acc-r_thin).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+
+  // Nothing is left after a reset.
+  accumulator.reset(H.cols());
+  accumulator.compress(H_acc, r_acc);
+  EXPECT_EQ(H_acc.rows(), 0);
+  EXPECT_EQ(r_acc.rows(), 0);
+  return;
+}
+
+TEST(GivensUtilsTest, measurementStack) {
+  MatrixXd H;
+  VectorXd r;
+  stackedJacobians(60, 20, H, r);
+  const MatrixXd A = MatrixXd::Random(H.cols(), H.cols());
+  const MatrixXd P = A * A.transpose();
+
+  // Add the features as long as there are no more rows than
+  // the state, and then the rest of them.
+  MeasurementStack stack(H.cols());
+  int row = 0;
+  for (int chunk = 7; row < H.rows(); row += chunk) {
+    chunk = min(chunk, static_cast<int>(H.rows())-row);
+    const bool is_compressed = row+chunk > H.cols();
+
+    // Keep the camera blocks of the rows which are nonzero.
+    const MatrixXd H_j = H.middleRows(row, chunk);
+    FeatureJacobian H_sparse;
+    for (int col = 21; col < H.cols(); col += 6) {
+      if (H_j.middleCols<6>(col).isZero(0.0)) continue;
+      H_sparse.cam_cols.push_back(col);
+      H_sparse.H_c.conservativeResize(chunk, H_sparse.H_c.cols()+6);
+      H_sparse.H_c.rightCols<6>() = H_j.middleCols<6>(col);
+    }
+    H_sparse.r = r.segment(row, chunk);
+
+    MatrixXd H_dense = MatrixXd::Zero(chunk, H.cols());
+    H_sparse.toDense(H_dense);
+    EXPECT_EQ(H_dense, H_j);
+
+    MatrixXd PHt_j = P * H_j.transpose();
+    stack.addRows(H_sparse, PHt_j);
+    EXPECT_EQ(stack.hasHP(), !is_compressed);
+
+    MatrixXd H_s, HP_s;
+    VectorXd r_s;
+    stack.measurement(H_s, r_s, HP_s);
+    if (!is_compressed) {
+      // The rows are kept as they are.
+      EXPECT_EQ(H_s, H.topRows(row+chunk));
+      EXPECT_EQ(r_s, r.head(row+chunk));
+      EXPECT_NEAR((HP_s-H.topRows(row+chunk)*P).cwiseAbs().maxCoeff(),
+          0.0, 1e-12);
+    } else {
+      MatrixXd H_thin;
+      VectorXd r_thin;
+      givensQrCompression(H.topRows(row+chunk), r.head(row+chunk),
+          H_thin, r_thin);
+      EXPECT_NEAR((H_s-H_thin).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+      EXPECT_NEAR((r_s-r_thin).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+    }
+  }
+  EXPECT_FALSE(stack.hasHP());
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(GivensUtilsTest, DISABLED_givensQrCompressionBenchmark) {
+  const int feature_nums[] = {20, 50, 100, 200};
+  for (const int& feature_num : feature_nums) {
+    MatrixXd H;
+    VectorXd r;
+    stackedJacobians(feature_num, 30, H, r);
+
+    auto start_time = chrono::steady_clock::now();
+    HouseholderQR<MatrixXd> qr_helper(H);
+    MatrixXd H_qr = H;
+    VectorXd r_qr = r;
+    H_qr.applyOnTheLeft(qr_helper.householderQ().transpose());
+    r_qr.applyOnTheLeft(qr_helper.householderQ().transpose());
+    double qr_time = chrono::duration<double>(
+        chrono::steady_clock::now()-start_time).count();
+
+    start_time = chrono::steady_clock::now();
+    MatrixXd H_thin;
+    VectorXd r_thin;
+    givensQrCompression(H, r, H_thin, r_thin);
+    double givens_time = chrono::duration<double>(
+        chrono::steady_clock::now()-start_time).count();
+
+    cout << H.rows() << "x" << H.cols() << ": householder "
+      << qr_time*1e3 << " ms, givens " << givens_time*1e3
+      << " ms, speedup " << qr_time/givens_time << endl;
+
+    const MatrixXd H_qr_thin = H_qr.topRows(H.cols());
+    const VectorXd r_qr_thin = r_qr.head(H.cols());
+    EXPECT_NEAR((H_qr_thin.transpose()*r_qr_thin -
+          H_thin.transpose()*r_thin).cwiseAbs().maxCoeff(), 0.0, 1e-8);
+  }
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,139 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <thread>
+#include <Eigen/Dense>
+#include <gtest/gtest.h>
+#include <msckf_vio/imu_buffer.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+ImuSample sampleAt(const double& time) {
+  ImuSample sample;
+  sample.time = time;
+  sample.gyro = Vector3d::Constant(time);
+  sample.acc = Vector3d::Constant(-time);
+  return sample;
+}
+
+} // end namespace
+
+TEST(ImuBufferTest, pushAndPop) {
+  ImuBuffer buffer(5);
+  EXPECT_EQ(buffer.capacity(), 8);
+  EXPECT_TRUE(buffer.empty());
+
+  // Wrap around the end of the ring a few times.
+  int next_sample = 0;
+  for (int round = 0; round < 10; ++round) {
+    while (buffer.push(sampleAt(next_sample))) ++next_sample;
+    EXPECT_EQ(buffer.size(), buffer.capacity());
+
+    const int first_sample = next_sample - buffer.size();
+    for (int i = 0; i < static_cast<int>(buffer.size()); ++i) {
+      EXPECT_EQ(buffer[i].time, first_sample+i);
+      EXPECT_EQ(buffer[i].gyro(0), first_sample+i);
+      EXPECT_EQ(buffer[i].acc(0), -(first_sample+i));
+    }
+    buffer.pop(3);
+    EXPECT_EQ(buffer[0].time, first_sample+3);
+  }
+
+  buffer.clear();
+  EXPECT_TRUE(buffer.empty());
+  return;
+}
+
+TEST(ImuBufferTest, rangeQueries) {
+  ImuBuffer buffer(16);
+  // Push and pop a few first so that the samples wrap around.
+  for (int i = 0; i < 10; ++i) buffer.push(sampleAt(-1.0));
+  buffer.pop(10);
+  for (int i = 0; i < 12; ++i) buffer.push(sampleAt(0.1*i));
+
+  EXPECT_EQ(buffer.lowerBound(-1.0), 0);
+  EXPECT_EQ(buffer.upperBound(-1.0), 0);
+  EXPECT_EQ(buffer.lowerBound(buffer[5].time), 5);
+  EXPECT_EQ(buffer.upperBound(buffer[5].time), 6);
+  EXPECT_EQ(buffer.lowerBound(0.55), 6);
+  EXPECT_EQ(buffer.upperBound(0.55), 6);
+  EXPECT_EQ(buffer.lowerBound(2.0), 12);
+  EXPECT_EQ(buffer.upperBound(2.0), 12);
+  return;
+}
+
+TEST(ImuBufferTest, droppedSamples) {
+  ImuBuffer buffer(4);
+  for (int i = 0; i < 4; ++i) EXPECT_TRUE(buffer.push(sampleAt(i)));
+  EXPECT_FALSE(buffer.push(sampleAt(4)));
+  EXPECT_FALSE(buffer.push(sampleAt(5)));
+  EXPECT_EQ(buffer.droppedNum(), 2);
+  EXPECT_FALSE(buffer.hasGap(0, 4));
+
+  // The first sample added after the drop follows the gap.
+  buffer.pop(3);
+  EXPECT_TRUE(buffer.push(sampleAt(6)));
+  EXPECT_TRUE(buffer.push(sampleAt(7)));
+  EXPECT_EQ(buffer.size(), 3);
+  EXPECT_FALSE(buffer.followsGap(0));
+  EXPECT_TRUE(buffer.followsGap(1));
+  EXPECT_FALSE(buffer.followsGap(2));
+  EXPECT_FALSE(buffer.hasGap(0, 1));
+  EXPECT_TRUE(buffer.hasGap(0, 3));
+  EXPECT_FALSE(buffer.hasGap(2, 3));
+
+  buffer.reset(8);
+  EXPECT_EQ(buffer.capacity(), 8);
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(buffer.droppedNum(), 0);
+  return;
+}
+
+TEST(ImuBufferTest, producerConsumer) {
+  const int sample_num = 20000;
+  ImuBuffer buffer(64);
+
+  // The producer yields while the buffer is full, and the
+  // consumer yields while it is empty, so that the two threads
+  // do not starve each other on a single core. The consumer
+  // checks that every sample arrives in order.
+  thread producer([&]() {
+    for (int i = 0; i < sample_num; ++i)
+      while (!buffer.push(sampleAt(i))) this_thread::yield();
+  });
+
+  int next_sample = 0;
+  bool is_ordered = true;
+  while (next_sample < sample_num) {
+    const size_t num = buffer.size();
+    if (num == 0) {
+      this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < num; ++i) {
+      is_ordered = is_ordered && buffer[i].time == next_sample &&
+        buffer[i].gyro(2) == next_sample &&
+        buffer[i].acc(2) == -next_sample;
+      ++next_sample;
+    }
+    buffer.pop(num);
+  }
+  producer.join();
+
+  EXPECT_TRUE(is_ordered);
+  EXPECT_TRUE(buffer.empty());
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
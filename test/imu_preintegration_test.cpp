@@ -0,0 +1,235 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <Eigen/Dense>
+#include <gtest/gtest.h>
+#include <msckf_vio/math_utils.hpp>
+#include <msckf_vio/imu_propagation.hpp>
+#include <msckf_vio/imu_preintegration.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+const Vector3d gravity(0.0, 0.0, -9.81);
+
+// IMU state propagated one msg at a time, the same way as
+// MsckfVio::processModel() without the observability constraint.
+struct ReferenceState {
+  Vector4d q;
+  Vector3d v;
+  Vector3d p;
+  Matrix<double, 21, 21> Phi;
+  Matrix<double, 21, 21> P;
+
+  void propagate(const Vector3d& gyro, const Vector3d& acc,
+      const Matrix<double, 12, 12>& Qc, const double& dt) {
+    const Matrix3d R_w_i = quaternionToRotation(q);
+    Matrix<double, 21, 21> Phi_k, Q_k;
+    imuTransitionMatrix(gyro, acc, R_w_i, dt, Phi_k);
+    imuProcessNoise(Phi_k, R_w_i, Qc, dt, Q_k);
+    Phi = Phi_k * Phi;
+    P = Phi_k*P*Phi_k.transpose() + Q_k;
+
+    // Same as MsckfVio::predictNewState().
+    const double gyro_norm = gyro.norm();
+    Matrix4d Omega = Matrix4d::Zero();
+    Omega.block<3, 3>(0, 0) = -skewSymmetric(gyro);
+    Omega.block<3, 1>(0, 3) = gyro;
+    Omega.block<1, 3>(3, 0) = -gyro;
+    const Vector4d dq_dt = (cos(gyro_norm*dt*0.5)*Matrix4d::Identity() +
+      1/gyro_norm*sin(gyro_norm*dt*0.5)*Omega) * q;
+    const Vector4d dq_dt2 = (cos(gyro_norm*dt*0.25)*Matrix4d::Identity() +
+      1/gyro_norm*sin(gyro_norm*dt*0.25)*Omega) * q;
+    const Matrix3d R0 = quaternionToRotation(q).transpose();
+    const Matrix3d R_half = quaternionToRotation(dq_dt2).transpose();
+    const Matrix3d R1 = quaternionToRotation(dq_dt).transpose();
+
+    const Vector3d k1_v_dot = R0*acc + gravity;
+    const Vector3d k2_v_dot = R_half*acc + gravity;
+    const Vector3d k4_v_dot = R1*acc + gravity;
+    const Vector3d k2_v = v + k1_v_dot*dt/2;
+    const Vector3d k3_v = v + k2_v_dot*dt/2;
+    const Vector3d k4_v = v + k2_v_dot*dt;
+
+    q = dq_dt;
+    quaternionNormalize(q);
+    p = p + dt/6*(v+2*k2_v+2*k3_v+k4_v);
+    v = v + dt/6*(k1_v_dot+4*k2_v_dot+k4_v_dot);
+    return;
+  }
+};
+
+Matrix<double, 12, 12> noiseCovariance() {
+  Matrix<double, 12, 12> Qc = Matrix<double, 12, 12>::Zero();
+  Qc.block<3, 3>(0, 0) = Matrix3d::Identity()*0.005*0.005;
+  Qc.block<3, 3>(3, 3) = Matrix3d::Identity()*0.001*0.001;
+  Qc.block<3, 3>(6, 6) = Matrix3d::Identity()*0.05*0.05;
+  Qc.block<3, 3>(9, 9) = Matrix3d::Identity()*0.01*0.01;
+  return Qc;
+}
+
+// Maximum difference of two matrices relative to the largest
+// coefficient of the reference.
+template <typename Derived1, typename Derived2>
+double relativeError(const MatrixBase<Derived1>& A,
+    const MatrixBase<Derived2>& A_ref) {
+  return (A-A_ref).cwiseAbs().maxCoeff() /
+    A_ref.cwiseAbs().maxCoeff();
+}
+
+} // end namespace
+
+TEST(ImuPreintegrationTest, sameAsPerSample) {
+  const Matrix<double, 12, 12> Qc = noiseCovariance();
+  const double dtime = 0.001;
+  const int sample_num = 50;
+
+  Vector3d gyro_bias = Vector3d::Random() * 0.01;
+  Vector3d acc_bias = Vector3d::Random() * 0.1;
+
+  ReferenceState ref;
+  ref.q = Vector4d::Random();
+  quaternionNormalize(ref.q);
+  ref.v = Vector3d::Random();
+  ref.p = Vector3d::Random();
+  ref.Phi.setIdentity();
+  ref.P.setZero();
+  const ReferenceState start = ref;
+
+  ImuPreintegration preintegration;
+  preintegration.reset(gyro_bias, acc_bias, Qc);
+
+  for (int i = 0; i < sample_num; ++i) {
+    Vector3d m_gyro = Vector3d::Random();
+    Vector3d m_acc = Vector3d::Random()*2.0 - gravity;
+    ref.propagate(m_gyro-gyro_bias, m_acc-acc_bias, Qc, dtime);
+    preintegration.integrate(dtime, m_gyro, m_acc);
+  }
+  EXPECT_NEAR(preintegration.dtime, sample_num*dtime, 1e-12);
+
+  // The mean is integrated with the same scheme.
+  const Matrix3d R_w_i = quaternionToRotation(start.q);
+  const double T = preintegration.dtime;
+  Matrix3d R_w_j = preintegration.delta_R.transpose() * R_w_i;
+  Vector3d v_j = start.v + gravity*T +
+    R_w_i.transpose()*preintegration.delta_v;
+  Vector3d p_j = start.p + start.v*T + 0.5*gravity*T*T +
+    R_w_i.transpose()*preintegration.delta_p;
+
+  EXPECT_NEAR((R_w_j-quaternionToRotation(ref.q)).cwiseAbs().maxCoeff(),
+      0.0, 1e-12);
+  EXPECT_NEAR((v_j-ref.v).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+  EXPECT_NEAR((p_j-ref.p).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+
+  // The transition and the noise are linearized differently,
+  // so they only agree up to the discretization error.
+  Matrix<double, 21, 21> Phi, Q;
+  preintegration.transition(R_w_i, preintegration.delta_R,
+      preintegration.delta_v, preintegration.delta_p, Phi, Q);
+  EXPECT_LT(relativeError(Phi, ref.Phi), 1e-3);
+  EXPECT_LT(relativeError(Q.topLeftCorner<15, 15>(),
+        ref.P.topLeftCorner<15, 15>()), 1e-2);
+  EXPECT_TRUE(Q.rightCols<6>().isZero());
+  return;
+}
+
+TEST(ImuPreintegrationTest, biasCorrection) {
+  const Matrix<double, 12, 12> Qc = noiseCovariance();
+  const double dtime = 0.001;
+  const int sample_num = 50;
+
+  vector<Vector3d> m_gyros, m_accs;
+  for (int i = 0; i < sample_num; ++i) {
+    m_gyros.push_back(Vector3d::Random());
+    m_accs.push_back(Vector3d::Random()*2.0 - gravity);
+  }
+
+  Vector3d gyro_bias = Vector3d::Random() * 0.01;
+  Vector3d acc_bias = Vector3d::Random() * 0.1;
+  Vector3d new_gyro_bias = gyro_bias + Vector3d::Random()*1e-3;
+  Vector3d new_acc_bias = acc_bias + Vector3d::Random()*1e-2;
+
+  ImuPreintegration old_preintegration, new_preintegration;
+  old_preintegration.reset(gyro_bias, acc_bias, Qc);
+  new_preintegration.reset(new_gyro_bias, new_acc_bias, Qc);
+  for (int i = 0; i < sample_num; ++i) {
+    old_preintegration.integrate(dtime, m_gyros[i], m_accs[i]);
+    new_preintegration.integrate(dtime, m_gyros[i], m_accs[i]);
+  }
+
+  Matrix3d delta_R;
+  Vector3d delta_v, delta_p;
+  old_preintegration.correctedDelta(new_gyro_bias, new_acc_bias,
+      delta_R, delta_v, delta_p);
+
+  // The correction should remove most of the difference.
+  const double R_diff = (old_preintegration.delta_R-
+      new_preintegration.delta_R).norm();
+  const double v_diff = (old_preintegration.delta_v-
+      new_preintegration.delta_v).norm();
+  const double p_diff = (old_preintegration.delta_p-
+      new_preintegration.delta_p).norm();
+  EXPECT_LT((delta_R-new_preintegration.delta_R).norm(), 1e-2*R_diff);
+  EXPECT_LT((delta_v-new_preintegration.delta_v).norm(), 1e-2*v_diff);
+  EXPECT_LT((delta_p-new_preintegration.delta_p).norm(), 1e-2*p_diff);
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(ImuPreintegrationTest, DISABLED_benchmark) {
+  const Matrix<double, 12, 12> Qc = noiseCovariance();
+  const double dtime = 0.001;
+  const int sample_num = 20000;
+
+  Vector3d gyro = Vector3d::Random();
+  Vector3d acc = Vector3d::Random() - gravity;
+
+  // Per-msg propagation of the IMU covariance, which is what
+  // the preintegration replaces between two images.
+  Vector4d q = Vector4d::Random();
+  quaternionNormalize(q);
+  const Matrix3d R_w_i = quaternionToRotation(q);
+  Matrix<double, 21, 21> P = Matrix<double, 21, 21>::Identity();
+  Matrix<double, 21, 21> Phi, Q;
+
+  auto start_time = chrono::steady_clock::now();
+  for (int i = 0; i < sample_num; ++i) {
+    imuTransitionMatrix(gyro, acc, R_w_i, dtime, Phi);
+    imuProcessNoise(Phi, R_w_i, Qc, dtime, Q);
+    P = Phi*P*Phi.transpose() + Q;
+  }
+  double per_sample_time = chrono::duration<double>(
+      chrono::steady_clock::now()-start_time).count();
+
+  ImuPreintegration preintegration;
+  preintegration.reset(Vector3d::Zero(), Vector3d::Zero(), Qc);
+  start_time = chrono::steady_clock::now();
+  for (int i = 0; i < sample_num; ++i)
+    preintegration.integrate(dtime, gyro, acc);
+  double preintegration_time = chrono::duration<double>(
+      chrono::steady_clock::now()-start_time).count();
+
+  cout << "per-sample covariance: " <<
+    per_sample_time/sample_num*1e6 << " us/sample" << endl;
+  cout << "preintegration: " <<
+    preintegration_time/sample_num*1e6 << " us/sample" << endl;
+  cout << "speedup: " << per_sample_time/preintegration_time << endl;
+
+  EXPECT_TRUE(P.allFinite());
+  EXPECT_TRUE(preintegration.noise_cov.allFinite());
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
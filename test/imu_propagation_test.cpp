@@ -0,0 +1,166 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <Eigen/Dense>
+#include <gtest/gtest.h>
+#include <msckf_vio/math_utils.hpp>
+#include <msckf_vio/imu_propagation.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+// Reference implementation with the dense 21x21 matrices.
+void denseTransition(const Vector3d& gyro, const Vector3d& acc,
+    const Matrix3d& R_w_i, const Matrix<double, 12, 12>& Qc,
+    const double& dtime, Matrix<double, 21, 21>& Phi,
+    Matrix<double, 21, 21>& Q) {
+  Matrix<double, 21, 21> F = Matrix<double, 21, 21>::Zero();
+  Matrix<double, 21, 12> G = Matrix<double, 21, 12>::Zero();
+
+  F.block<3, 3>(0, 0) = -skewSymmetric(gyro);
+  F.block<3, 3>(0, 3) = -Matrix3d::Identity();
+  F.block<3, 3>(6, 0) = -R_w_i.transpose()*skewSymmetric(acc);
+  F.block<3, 3>(6, 9) = -R_w_i.transpose();
+  F.block<3, 3>(12, 6) = Matrix3d::Identity();
+
+  G.block<3, 3>(0, 0) = -Matrix3d::Identity();
+  G.block<3, 3>(3, 3) = Matrix3d::Identity();
+  G.block<3, 3>(6, 6) = -R_w_i.transpose();
+  G.block<3, 3>(9, 9) = Matrix3d::Identity();
+
+  Matrix<double, 21, 21> Fdt = F * dtime;
+  Matrix<double, 21, 21> Fdt_square = Fdt * Fdt;
+  Matrix<double, 21, 21> Fdt_cube = Fdt_square * Fdt;
+  Phi = Matrix<double, 21, 21>::Identity() +
+    Fdt + 0.5*Fdt_square + (1.0/6.0)*Fdt_cube;
+
+  Q = Phi*G*Qc*G.transpose()*Phi.transpose()*dtime;
+  return;
+}
+
+Matrix<double, 12, 12> noiseCovariance() {
+  Matrix<double, 12, 12> Qc = Matrix<double, 12, 12>::Zero();
+  Qc.block<3, 3>(0, 0) = Matrix3d::Identity()*0.005*0.005;
+  Qc.block<3, 3>(3, 3) = Matrix3d::Identity()*0.001*0.001;
+  Qc.block<3, 3>(6, 6) = Matrix3d::Identity()*0.05*0.05;
+  Qc.block<3, 3>(9, 9) = Matrix3d::Identity()*0.01*0.01;
+  return Qc;
+}
+
+} // end namespace
+
+TEST(ImuPropagationTest, sameAsDense) {
+  const Matrix<double, 12, 12> Qc = noiseCovariance();
+  const double dtime = 0.005;
+
+  for (int i = 0; i < 100; ++i) {
+    Vector3d gyro = Vector3d::Random();
+    Vector3d acc = Vector3d::Random() * 10.0;
+    Vector4d q = Vector4d::Random();
+    quaternionNormalize(q);
+    Matrix3d R_w_i = quaternionToRotation(q);
+
+    Matrix<double, 21, 21> Phi_dense, Q_dense;
+    denseTransition(gyro, acc, R_w_i, Qc, dtime, Phi_dense, Q_dense);
+
+    Matrix<double, 21, 21> Phi, Q;
+    imuTransitionMatrix(gyro, acc, R_w_i, dtime, Phi);
+    imuProcessNoise(Phi, R_w_i, Qc, dtime, Q);
+
+    EXPECT_NEAR((Phi-Phi_dense).cwiseAbs().maxCoeff(), 0.0, 1e-14);
+    EXPECT_NEAR((Q-Q_dense).cwiseAbs().maxCoeff(), 0.0,
+        1e-12*Q_dense.cwiseAbs().maxCoeff());
+  }
+  return;
+}
+
+TEST(ImuPropagationTest, transitionMultiply) {
+  const double dtime = 0.005;
+
+  // Accumulate a few transitions, and apply the product to a
+  // cross covariance block as done once per image.
+  Matrix<double, 21, 21> Phi_dense = Matrix<double, 21, 21>::Identity();
+  Matrix<double, 21, 21> Phi_accum = Matrix<double, 21, 21>::Identity();
+  for (int i = 0; i < 10; ++i) {
+    Vector3d gyro = Vector3d::Random();
+    Vector3d acc = Vector3d::Random() * 10.0;
+    Vector4d q = Vector4d::Random();
+    quaternionNormalize(q);
+
+    Matrix<double, 21, 21> Phi;
+    imuTransitionMatrix(gyro, acc, quaternionToRotation(q), dtime, Phi);
+    // Mimic the observability constraint, which rewrites the
+    // orientation, velocity and position rows of the first
+    // block column.
+    for (int j = 0; j < 15; j += 6)
+      Phi.block<3, 3>(j, 0) += Matrix3d::Random() * dtime;
+
+    Phi_dense = Phi * Phi_dense;
+    imuTransitionMultiply(Phi, Phi_accum);
+  }
+  EXPECT_NEAR((Phi_accum-Phi_dense).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+
+  MatrixXd P12 = MatrixXd::Random(21, 60);
+  MatrixXd P12_dense = Phi_dense * P12;
+  imuTransitionMultiply(Phi_accum, P12);
+  EXPECT_NEAR((P12-P12_dense).cwiseAbs().maxCoeff(), 0.0, 1e-12);
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(ImuPropagationTest, DISABLED_benchmark) {
+  const Matrix<double, 12, 12> Qc = noiseCovariance();
+  const double dtime = 0.005;
+  const int sample_num = 100000;
+
+  Vector3d gyro = Vector3d::Random();
+  Vector3d acc = Vector3d::Random() * 10.0;
+  Vector4d q = Vector4d::Random();
+  quaternionNormalize(q);
+  Matrix3d R_w_i = quaternionToRotation(q);
+
+  // Accumulate the results so that none of the loops can be
+  // optimized away.
+  Matrix<double, 21, 21> Phi, Q;
+  double dense_sum = 0.0, kernel_sum = 0.0;
+
+  auto start_time = chrono::steady_clock::now();
+  for (int i = 0; i < sample_num; ++i) {
+    gyro(0) += 1e-9;
+    denseTransition(gyro, acc, R_w_i, Qc, dtime, Phi, Q);
+    dense_sum += Phi(0, 0) + Q(0, 0);
+  }
+  double dense_time = chrono::duration<double>(
+      chrono::steady_clock::now()-start_time).count();
+
+  start_time = chrono::steady_clock::now();
+  for (int i = 0; i < sample_num; ++i) {
+    gyro(0) -= 1e-9;
+    imuTransitionMatrix(gyro, acc, R_w_i, dtime, Phi);
+    imuProcessNoise(Phi, R_w_i, Qc, dtime, Q);
+    kernel_sum += Phi(0, 0) + Q(0, 0);
+  }
+  double kernel_time = chrono::duration<double>(
+      chrono::steady_clock::now()-start_time).count();
+
+  cout << "dense Phi/Q: " << dense_time/sample_num*1e6 << " us/sample" << endl;
+  cout << "block Phi/Q: " << kernel_time/sample_num*1e6 << " us/sample" << endl;
+  cout << "speedup: " << dense_time/kernel_time << endl;
+
+  EXPECT_NEAR(dense_sum, kernel_sum, 1e-6*std::abs(dense_sum));
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
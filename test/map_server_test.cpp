@@ -0,0 +1,169 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <map>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <gtest/gtest.h>
+#include <msckf_vio/feature.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+typedef std::map<FeatureIDType, Feature, std::less<FeatureIDType>,
+        Eigen::aligned_allocator<
+        std::pair<const FeatureIDType, Feature> > > FeatureMap;
+
+void eraseFeatures(const vector<FeatureIDType>& ids, FeatureMap& features) {
+  for (const auto& id : ids) features.erase(id);
+  return;
+}
+
+void eraseFeatures(const vector<FeatureIDType>& ids, MapServer& features) {
+  features.erase(ids);
+  return;
+}
+
+// Run frames in which a tenth of the features are lost and
+// replaced by new ones, and every live feature is looked up by
+// its id and visited once. Returns the seconds per frame.
+template <typename Map>
+double runFrames(const int& feature_num, const int& frame_num,
+    Map& features, double& sum) {
+  FeatureIDType next_id = 0;
+  for (; next_id < feature_num; ++next_id)
+    features[next_id].id = next_id;
+
+  vector<FeatureIDType> live_ids(0), lost_ids(0);
+  srand(0);
+  auto start_time = chrono::steady_clock::now();
+  for (int frame = 0; frame < frame_num; ++frame) {
+    live_ids.clear();
+    lost_ids.clear();
+    for (const auto& item : features) {
+      if (rand()%10 == 0) lost_ids.push_back(item.first);
+      else live_ids.push_back(item.first);
+    }
+
+    for (const auto& id : live_ids)
+      features.find(id)->second.position(0) += 1.0;
+    eraseFeatures(lost_ids, features);
+    for (size_t i = 0; i < lost_ids.size(); ++i, ++next_id)
+      features[next_id].id = next_id;
+
+    for (const auto& item : features) sum += item.second.position(0);
+  }
+  return chrono::duration<double>(
+      chrono::steady_clock::now()-start_time).count() / frame_num;
+}
+
+} // end namespace
+
+TEST(MapServerTest, sameAsMap) {
+  MapServer map_server;
+  FeatureMap reference;
+
+  srand(0);
+  FeatureIDType next_id = 0;
+  for (int frame = 0; frame < 200; ++frame) {
+    // Observe some of the old features and a few new ones.
+    for (int i = 0; i < 50; ++i) {
+      const FeatureIDType id = rand()%3 ? next_id++ :
+        rand() % (next_id+1);
+      const auto result = map_server.emplace(id, Feature(id));
+      EXPECT_EQ(result.second, reference.count(id) == 0);
+      EXPECT_EQ(result.first->first, id);
+      if (result.second) reference[id] = Feature(id);
+      result.first->second.position(0) += 1.0;
+      reference[id].position(0) += 1.0;
+    }
+
+    // Lose some of the features, one by one or in a batch.
+    vector<FeatureIDType> lost_ids(0);
+    for (const auto& item : reference)
+      if (rand()%4 == 0) lost_ids.push_back(item.first);
+    if (frame % 2 == 0) {
+      for (const auto& id : lost_ids)
+        EXPECT_EQ(map_server.erase(id), 1);
+    } else {
+      map_server.erase(lost_ids);
+    }
+    for (const auto& id : lost_ids) {
+      reference.erase(id);
+      EXPECT_EQ(map_server.count(id), 0);
+      EXPECT_TRUE(map_server.find(id) == map_server.end());
+    }
+
+    // The features are visited in the order they are added.
+    ASSERT_EQ(map_server.size(), reference.size());
+    map<FeatureIDType, double> visited;
+    FeatureIDType last_id = -1;
+    bool is_sorted = true;
+    for (const auto& item : map_server) {
+      visited[item.first] = item.second.position(0);
+      is_sorted = is_sorted && item.first > last_id;
+      last_id = item.first;
+    }
+    ASSERT_EQ(visited.size(), reference.size());
+    for (const auto& item : reference) {
+      EXPECT_EQ(visited[item.first], item.second.position(0));
+      EXPECT_EQ(map_server.find(item.first)->second.id, item.first);
+    }
+    if (frame == 0) {
+      EXPECT_TRUE(is_sorted);
+    }
+  }
+
+  map_server.clear();
+  EXPECT_TRUE(map_server.empty());
+  EXPECT_TRUE(map_server.begin() == map_server.end());
+  return;
+}
+
+TEST(MapServerTest, sameAsMapFrames) {
+  const int feature_nums[] = {30, 300};
+  for (const int& feature_num : feature_nums) {
+    double map_sum = 0.0, map_server_sum = 0.0;
+    FeatureMap features;
+    runFrames(feature_num, 50, features, map_sum);
+    MapServer map_server;
+    runFrames(feature_num, 50, map_server, map_server_sum);
+    EXPECT_EQ(map_sum, map_server_sum);
+  }
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(MapServerTest, DISABLED_benchmark) {
+  const int feature_nums[] = {300, 1000, 5000};
+  for (const int& feature_num : feature_nums) {
+    double map_sum = 0.0, map_server_sum = 0.0;
+
+    FeatureMap features;
+    const double map_time = runFrames(
+        feature_num, 200, features, map_sum);
+    MapServer map_server;
+    const double map_server_time = runFrames(
+        feature_num, 200, map_server, map_server_sum);
+
+    cout << feature_num << " features: std::map "
+      << map_time*1e6 << " us, map server " << map_server_time*1e6
+      << " us per frame, speedup " << map_time/map_server_time << endl;
+    EXPECT_EQ(map_sum, map_server_sum);
+  }
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,89 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <map>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <msckf_vio/observation_map.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+namespace {
+
+typedef map<StateIDType, Vector4d, less<StateIDType>,
+        aligned_allocator<pair<const StateIDType, Vector4d> > >
+        ReferenceMap;
+
+void checkObservations(const ObservationMap& observations,
+    const ReferenceMap& reference) {
+  ASSERT_EQ(observations.size(), reference.size());
+  auto ref_iter = reference.begin();
+  for (const auto& item : observations) {
+    EXPECT_EQ(item.first, ref_iter->first);
+    EXPECT_EQ(item.second, ref_iter->second);
+    EXPECT_EQ(observations.find(item.first)->second, item.second);
+    ++ref_iter;
+  }
+  return;
+}
+
+} // end namespace
+
+TEST(ObservationMapTest, sameAsMap) {
+  srand(0);
+  for (int track_length = 1; track_length < 40; track_length += 3) {
+    ObservationMap observations;
+    ReferenceMap reference;
+
+    // Observations from consecutive camera states, with a few
+    // of them skipped.
+    for (StateIDType id = 100; id < 100+track_length; ++id) {
+      if (rand()%5 == 0) continue;
+      const Vector4d z = Vector4d::Random();
+      observations[id] = z;
+      reference[id] = z;
+    }
+    checkObservations(observations, reference);
+
+    // Ids which are not observed.
+    EXPECT_TRUE(observations.find(99) == observations.end());
+    EXPECT_TRUE(observations.find(200) == observations.end());
+    EXPECT_EQ(observations.count(200), 0);
+    EXPECT_EQ(observations.erase(200), 0);
+
+    // Overwrite and add observations out of order.
+    for (int i = 0; i < 10; ++i) {
+      const StateIDType id = 95 + rand()%(track_length+10);
+      const Vector4d z = Vector4d::Random();
+      observations[id] = z;
+      reference[id] = z;
+    }
+    checkObservations(observations, reference);
+
+    // Remove the observations of some camera states, as in
+    // pruning the camera states.
+    for (int i = 0; i < 10; ++i) {
+      const StateIDType id = 95 + rand()%(track_length+10);
+      EXPECT_EQ(observations.erase(id), reference.erase(id));
+      EXPECT_EQ(observations.count(id), 0);
+    }
+    checkObservations(observations, reference);
+
+    // Copies do not share the storage.
+    ObservationMap copy = observations;
+    if (!copy.empty()) copy.begin()->second.setZero();
+    checkObservations(observations, reference);
+  }
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,45 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <vector>
+#include <gtest/gtest.h>
+#include <msckf_vio/thread_pool.hpp>
+
+using namespace std;
+using namespace msckf_vio;
+
+TEST(ThreadPoolTest, parallelFor) {
+  ThreadPool thread_pool(4);
+  EXPECT_EQ(thread_pool.size(), 4);
+
+  // Run loops of different lengths back to back, and check
+  // that every iteration runs exactly once.
+  for (int n = 0; n < 200; n += 7) {
+    vector<int> counts(n, 0);
+    thread_pool.parallelFor(n, [&counts](int i) { ++counts[i]; });
+    for (int i = 0; i < n; ++i) EXPECT_EQ(counts[i], 1);
+  }
+  return;
+}
+
+TEST(ThreadPoolTest, singleThread) {
+  ThreadPool thread_pool(1);
+  EXPECT_EQ(thread_pool.size(), 1);
+
+  // Without workers, the iterations run in order on the
+  // calling thread.
+  vector<int> order;
+  thread_pool.parallelFor(10, [&order](int i) { order.push_back(i); });
+  ASSERT_EQ(order.size(), 10);
+  for (int i = 0; i < 10; ++i) EXPECT_EQ(order[i], i);
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
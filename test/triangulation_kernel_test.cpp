@@ -0,0 +1,176 @@
+/*
+ * COPYRIGHT AND PERMISSION NOTICE
+ * Penn Software MSCKF_VIO
+ * Copyright (C) 2017 The Trustees of the University of Pennsylvania
+ * All rights reserved.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+#include <gtest/gtest.h>
+
+#include <msckf_vio/cam_state.h>
+#include <msckf_vio/feature.hpp>
+#include <msckf_vio/triangulation_kernel.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace msckf_vio;
+
+// Static member variables in CAMState class
+Isometry3d CAMState::T_cam0_cam1 = Isometry3d::Identity();
+
+// Static member variables in Feature class
+Feature::OptimizationConfig Feature::optimization_config;
+
+namespace {
+
+// Relative poses of cameras looking at a feature around
+// [0, 0, 4] in the first camera frame, with measurements
+// corrupted by noise.
+void randomObservations(const int& n,
+    vector<Isometry3d, aligned_allocator<Isometry3d> >& poses,
+    vector<Vector2d, aligned_allocator<Vector2d> >& measurements) {
+  const Vector3d feature(0.3, -0.2, 4.0);
+  poses.resize(n);
+  measurements.resize(n);
+  for (int i = 0; i < n; ++i) {
+    poses[i].linear() = AngleAxisd(0.05*i, Vector3d::UnitY()) *
+      AngleAxisd(0.02*i, Vector3d::UnitX()).toRotationMatrix();
+    poses[i].translation() = Vector3d(-0.1*i, 0.02*i, 0.01*i);
+    const Vector3d p = poses[i] * feature;
+    // Every third measurement is an outlier for the Huber kernel.
+    const double noise = i%3 == 0 ? 0.05 : 0.001;
+    measurements[i] = Vector2d(p(0)/p(2), p(1)/p(2)) +
+      noise*Vector2d::Random();
+  }
+  return;
+}
+
+} // end namespace
+
+TEST(TriangulationKernelTest, sameAsFeature) {
+  const Feature feature;
+  const double huber_epsilon =
+    Feature::optimization_config.huber_epsilon;
+  const Vector3d x(0.1, -0.04, 0.3);
+
+  for (int n = 1; n <= 30; ++n) {
+    vector<Isometry3d, aligned_allocator<Isometry3d> > poses;
+    vector<Vector2d, aligned_allocator<Vector2d> > measurements;
+    randomObservations(n, poses, measurements);
+
+    // Reference computed one observation at a time.
+    double cost_ref = 0.0;
+    Matrix3d A_ref = Matrix3d::Zero();
+    Vector3d b_ref = Vector3d::Zero();
+    for (int i = 0; i < n; ++i) {
+      double e = 0.0;
+      feature.cost(poses[i], x, measurements[i], e);
+      cost_ref += e;
+
+      Matrix<double, 2, 3> J;
+      Vector2d r;
+      double w;
+      feature.jacobian(poses[i], x, measurements[i], J, r, w);
+      A_ref += w * w * J.transpose() * J;
+      b_ref += w * w * J.transpose() * r;
+    }
+
+    TriangulationObservations obs;
+    obs.resize(n);
+    for (int i = 0; i < n; ++i) obs.set(i, poses[i], measurements[i]);
+
+    // Both the scalar and the (if supported) SIMD kernels.
+    for (int use_simd = 0; use_simd < 2; ++use_simd) {
+      const double cost = triangulationCost(obs, x, use_simd);
+      Matrix3d A;
+      Vector3d b;
+      triangulationNormalEquations(obs, x, huber_epsilon, A, b, use_simd);
+
+      EXPECT_NEAR(cost, cost_ref, 1e-12*cost_ref);
+      EXPECT_NEAR((A-A_ref).cwiseAbs().maxCoeff(), 0.0,
+          1e-12*A_ref.cwiseAbs().maxCoeff());
+      EXPECT_NEAR((b-b_ref).cwiseAbs().maxCoeff(), 0.0,
+          1e-12*b_ref.cwiseAbs().maxCoeff());
+    }
+  }
+  return;
+}
+
+// Timing only. Run with --gtest_also_run_disabled_tests.
+TEST(TriangulationKernelTest, DISABLED_benchmark) {
+  cout << "AVX2 kernel supported: " <<
+    triangulation_kernel::useAvx2() << endl;
+
+  const Feature feature;
+  const double huber_epsilon =
+    Feature::optimization_config.huber_epsilon;
+  const Vector3d x(0.1, -0.04, 0.3);
+  const int repeat_num = 20000;
+
+  const int track_lengths[] = {3, 10, 30};
+  for (const int& n : track_lengths) {
+    vector<Isometry3d, aligned_allocator<Isometry3d> > poses;
+    vector<Vector2d, aligned_allocator<Vector2d> > measurements;
+    randomObservations(n, poses, measurements);
+    TriangulationObservations obs;
+    obs.resize(n);
+    for (int i = 0; i < n; ++i) obs.set(i, poses[i], measurements[i]);
+
+    // One cost and one set of normal equations, as in an
+    // iteration of the LM loop.
+    double feature_sum = 0.0;
+    auto start_time = chrono::steady_clock::now();
+    for (int k = 0; k < repeat_num; ++k) {
+      Matrix3d A = Matrix3d::Zero();
+      Vector3d b = Vector3d::Zero();
+      double cost = 0.0;
+      for (int i = 0; i < n; ++i) {
+        Matrix<double, 2, 3> J;
+        Vector2d r;
+        double w, e;
+        feature.jacobian(poses[i], x, measurements[i], J, r, w);
+        A += w * w * J.transpose() * J;
+        b += w * w * J.transpose() * r;
+        feature.cost(poses[i], x, measurements[i], e);
+        cost += e;
+      }
+      feature_sum += A(0, 0) + b(0) + cost;
+    }
+    const double feature_time = chrono::duration<double>(
+        chrono::steady_clock::now()-start_time).count();
+
+    double times[2], sums[2] = {0.0, 0.0};
+    for (int use_simd = 0; use_simd < 2; ++use_simd) {
+      start_time = chrono::steady_clock::now();
+      for (int k = 0; k < repeat_num; ++k) {
+        Matrix3d A;
+        Vector3d b;
+        triangulationNormalEquations(obs, x, huber_epsilon, A, b, use_simd);
+        sums[use_simd] += A(0, 0) + b(0) + triangulationCost(obs, x, use_simd);
+      }
+      times[use_simd] = chrono::duration<double>(
+          chrono::steady_clock::now()-start_time).count();
+    }
+
+    cout << "track length " << n << ": per observation "
+      << feature_time/repeat_num*1e6 << " us, scalar arrays "
+      << times[0]/repeat_num*1e6 << " us, simd "
+      << times[1]/repeat_num*1e6 << " us" << endl;
+
+    EXPECT_NEAR(sums[0], feature_sum, 1e-8*std::abs(feature_sum));
+    EXPECT_NEAR(sums[1], feature_sum, 1e-8*std::abs(feature_sum));
+  }
+  return;
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}